@@ -9,11 +9,26 @@
 #pragma code_seg("PAGE")
 
 BASIC_DISPLAY_DRIVER::BASIC_DISPLAY_DRIVER(_In_ DEVICE_OBJECT *pPhysicalDeviceObject)
-    : m_pPhysicalDevice(pPhysicalDeviceObject), //
-      m_MappedBar2(NULL),                       //
-      m_MonitorPowerState(PowerDeviceD0),       //
-      m_AdapterPowerState(PowerDeviceD0),       //
-      m_SystemDisplaySourceId(D3DDDI_ID_UNINITIALIZED) {
+    : m_pPhysicalDevice(pPhysicalDeviceObject),         //
+      m_MappedBar2(NULL),                               //
+      m_MonitorPowerState(PowerDeviceD0),               //
+      m_AdapterPowerState(PowerDeviceD0),               //
+      m_SystemDisplaySourceId(D3DDDI_ID_UNINITIALIZED), //
+      m_ChangeDetection(BDD_CHANGE_DETECTION_NONE),     //
+      m_DoubleBuffer(FALSE),                            //
+      m_ScrollPanning(FALSE),                           //
+      m_PresentRate(0),                                 //
+      m_WriteBudget(0),                                 //
+      m_DeferredFlushInterval(0),                       //
+      m_pVSyncTimer(NULL),                              //
+      m_VSyncTimerSet(FALSE),                           //
+      m_VSyncInterrupt(FALSE),                          //
+      m_FastResume(FALSE),                              //
+      m_ResumePending(FALSE),                           //
+      m_pResumeFrame(NULL),                             //
+      m_ResumeFrameSize(0),                             //
+      m_SeamlessBoot(FALSE),                            //
+      m_SeamlessAdoptPending(FALSE) {
     PAGED_CODE();
     *((UINT *)&m_Flags) = 0;
     m_Flags._LastFlag = TRUE;
@@ -23,6 +38,9 @@ BASIC_DISPLAY_DRIVER::BASIC_DISPLAY_DRIVER(_In_ DEVICE_OBJECT *pPhysicalDeviceOb
     RtlZeroMemory(&m_CurrentModes, sizeof(m_CurrentModes));
     RtlZeroMemory(&m_DeviceInfo, sizeof(m_DeviceInfo));
     RtlZeroMemory(&m_VbeInfo, sizeof(m_VbeInfo));
+    RtlZeroMemory(&m_ResumeDispi, sizeof(m_ResumeDispi));
+    RtlZeroMemory(&m_ResumeMode, sizeof(m_ResumeMode));
+    KeInitializeSpinLock(&m_DispiLock);
 
     for (UINT i = 0; i < MAX_VIEWS; i++) {
         m_HardwareBlt[i].Initialize(this, i);
@@ -32,7 +50,13 @@ BASIC_DISPLAY_DRIVER::BASIC_DISPLAY_DRIVER(_In_ DEVICE_OBJECT *pPhysicalDeviceOb
 BASIC_DISPLAY_DRIVER::~BASIC_DISPLAY_DRIVER() {
     PAGED_CODE();
 
+    for (UINT i = 0; i < MAX_VIEWS; i++) {
+        m_HardwareBlt[i].StopPresentWorker();
+    }
+
     CleanUp();
+
+    delete[] m_pResumeFrame;
 }
 
 NTSTATUS BASIC_DISPLAY_DRIVER::StartDevice(
@@ -69,6 +93,9 @@ NTSTATUS BASIC_DISPLAY_DRIVER::StartDevice(
         return Status;
     }
 
+    // Needed by StartHardware for seamless boot
+    ReadConfiguration();
+
     Status = StartHardware();
     if (!NT_SUCCESS(Status)) {
         BDD_LOG_ERROR("StartHardware failed with status 0x%x", Status);
@@ -93,6 +120,24 @@ NTSTATUS BASIC_DISPLAY_DRIVER::StartDevice(
         goto OutStopHardware;
     }
 
+    BltInitialize();
+    CalibrateBlt();
+
+    // Without the timer neither presents are paced nor VSync is reported
+    m_pVSyncTimer = ExAllocateTimer(VSyncTimerCallback, this, EX_TIMER_HIGH_RESOLUTION);
+    if (m_pVSyncTimer == NULL) {
+        BDD_LOG_WARNING("ExAllocateTimer failed, presents are not paced");
+    }
+
+    // A source whose worker fails to start falls back to executing its presents synchronously
+    for (UINT i = 0; i < MAX_VIEWS; i++) {
+        m_HardwareBlt[i].StartPresentWorker(
+            m_PresentRate != 0 && m_pVSyncTimer != NULL,
+            m_WriteBudget,
+            m_DeferredFlushInterval);
+    }
+    UpdateVSyncTimer();
+
     // Ignore return value, since it's not the end of the world if we failed to write these values to the registry
     RegisterHWInfo();
 
@@ -111,6 +156,11 @@ OutStopHardware:
 NTSTATUS BASIC_DISPLAY_DRIVER::StopDevice(VOID) {
     PAGED_CODE();
 
+    for (UINT i = 0; i < MAX_VIEWS; i++) {
+        m_HardwareBlt[i].StopPresentWorker();
+    }
+    InvalidateSourceCaches();
+
     CleanUp();
 
     StopHardware();
@@ -123,17 +173,44 @@ NTSTATUS BASIC_DISPLAY_DRIVER::StopDevice(VOID) {
 VOID BASIC_DISPLAY_DRIVER::CleanUp() {
     PAGED_CODE();
 
+    // Waits for a running callback, which may still signal the present workers
+    if (m_pVSyncTimer != NULL) {
+        ExDeleteTimer(m_pVSyncTimer, TRUE, TRUE, NULL);
+        m_pVSyncTimer = NULL;
+        m_VSyncTimerSet = FALSE;
+    }
+    m_VSyncInterrupt = FALSE;
+
+    // The saved frame buffer mapping is gone
+    m_ResumePending = FALSE;
+
     for (UINT Source = 0; Source < MAX_VIEWS; ++Source) {
         if (m_CurrentModes[Source].FrameBuffer.Ptr) {
             UnmapFrameBuffer(
                 m_CurrentModes[Source].FrameBuffer.Ptr,
-                m_CurrentModes[Source].DispInfo.Height * m_CurrentModes[Source].DispInfo.Pitch);
+                GetFrameBufferMappingSize(&m_CurrentModes[Source]));
             m_CurrentModes[Source].FrameBuffer.Ptr = NULL;
             m_CurrentModes[Source].Flags.FrameBufferIsActive = FALSE;
         }
     }
 }
 
+VOID BASIC_DISPLAY_DRIVER::WaitForPresents() {
+    PAGED_CODE();
+
+    for (UINT i = 0; i < MAX_VIEWS; i++) {
+        m_HardwareBlt[i].WaitForPresents();
+    }
+}
+
+VOID BASIC_DISPLAY_DRIVER::InvalidateSourceCaches() {
+    PAGED_CODE();
+
+    for (UINT i = 0; i < MAX_VIEWS; i++) {
+        m_HardwareBlt[i].InvalidateSourceCache(NULL);
+    }
+}
+
 NTSTATUS
 BASIC_DISPLAY_DRIVER::DispatchIoRequest(_In_ ULONG VidPnSourceId, _In_ VIDEO_REQUEST_PACKET *pVideoRequestPacket) {
     PAGED_CODE();
@@ -156,8 +233,17 @@ NTSTATUS BASIC_DISPLAY_DRIVER::SetPowerState(
 
     BDD_ASSERT((HardwareUid < MAX_CHILDREN) || (HardwareUid == DISPLAY_ADAPTER_HW_ID));
 
+    WaitForPresents();
+    InvalidateSourceCaches();
+
     if (HardwareUid == DISPLAY_ADAPTER_HW_ID) {
+        if (DevicePowerState != PowerDeviceD0 && m_AdapterPowerState == PowerDeviceD0) {
+            SaveResumeState();
+        }
+
         if (DevicePowerState == PowerDeviceD0) {
+            LARGE_INTEGER Start = KeQueryPerformanceCounter(NULL);
+
             // get the previous firmware mode
             Status = m_DxgkInterface.DxgkCbAcquirePostDisplayOwnership(
                 m_DxgkInterface.DeviceHandle,
@@ -171,10 +257,31 @@ NTSTATUS BASIC_DISPLAY_DRIVER::SetPowerState(
 
             // When returning from D3 the device visibility defined to be off for all targets
             if (m_AdapterPowerState == PowerDeviceD3) {
-                DXGKARG_SETVIDPNSOURCEVISIBILITY Visibility;
-                Visibility.VidPnSourceId = D3DDDI_ID_ALL;
-                Visibility.Visible = FALSE;
-                SetVidPnSourceVisibility(&Visibility);
+                // The surfaces of the presents made before D3 are gone, and video memory may not have been kept
+                for (UINT i = 0; i < MAX_VIEWS; i++) {
+                    m_HardwareBlt[i].DiscardDarkPresents(NULL);
+                    m_CurrentModes[i].ZeroedOutStart.QuadPart = 0;
+                    m_CurrentModes[i].ZeroedOutEnd.QuadPart = 0;
+                }
+
+                if (FastResume()) {
+                    // The restored frame stays on screen instead of being blacked out, the presents made until Windows
+                    // shows the source again are caught up then
+                    m_CurrentModes[0].Flags.SourceNotVisible = TRUE;
+
+                    LARGE_INTEGER Frequency;
+                    LONGLONG Ticks = KeQueryPerformanceCounter(&Frequency).QuadPart - Start.QuadPart;
+                    BDD_LOG_INFO(
+                        "Resumed %ux%u from D3 in %I64d us",
+                        m_CurrentModes[0].DispInfo.Width,
+                        m_CurrentModes[0].DispInfo.Height,
+                        Ticks * 1000000 / Frequency.QuadPart);
+                } else {
+                    DXGKARG_SETVIDPNSOURCEVISIBILITY Visibility;
+                    Visibility.VidPnSourceId = D3DDDI_ID_ALL;
+                    Visibility.Visible = FALSE;
+                    SetVidPnSourceVisibility(&Visibility);
+                }
             }
         }
 
@@ -191,10 +298,122 @@ NTSTATUS BASIC_DISPLAY_DRIVER::SetPowerState(
         }
 
         m_MonitorPowerState = DevicePowerState;
+        if (DevicePowerState == PowerDeviceD0) {
+            CatchUpDarkPresents(FindSourceForTarget(HardwareUid, TRUE));
+        }
         return STATUS_SUCCESS;
     }
 }
 
+VOID BASIC_DISPLAY_DRIVER::SaveResumeState()
+/*++
+
+  Routine Description:
+
+    The method saves the DISPI registers, the mode of source 0 and a copy
+    of its visible frame, so FastResume can show them again without waiting
+    for Windows to commit its VidPn and present a full frame. DISPI drives
+    a single source. The frame is drawn from the shadow frame buffer when
+    change detection keeps one. Otherwise it is read back from video
+    memory, which is slow at high resolutions as the frame buffer is mapped
+    write-combined, and delays the power down accordingly.
+
+  Arguments:
+
+    None
+
+  Return Value:
+
+    None
+
+--*/
+{
+    PAGED_CODE();
+
+    m_ResumePending = FALSE;
+
+    CONST CURRENT_BDD_MODE *pMode = &m_CurrentModes[0];
+    if (!m_FastResume || m_MappedBar2 == NULL || !pMode->Flags.FrameBufferIsActive || pMode->FrameBuffer.Ptr == NULL) {
+        return;
+    }
+
+    SaveVBEState(m_ResumeDispi);
+    if (!(m_ResumeDispi[VBE_DISPI_INDEX_ENABLE] & VBE_DISPI_ENABLED) ||
+        m_ResumeDispi[VBE_DISPI_INDEX_Y_OFFSET] + pMode->DispInfo.Height > pMode->VirtualHeight) {
+        return;
+    }
+
+    SIZE_T Size = (SIZE_T)pMode->DispInfo.Pitch * pMode->DispInfo.Height;
+    if (Size > m_ResumeFrameSize) {
+        delete[] m_pResumeFrame;
+        m_pResumeFrame = new (PagedPool) BYTE[Size];
+        m_ResumeFrameSize = (m_pResumeFrame != NULL) ? Size : 0;
+        if (m_pResumeFrame == NULL) {
+            BDD_LOG_WARNING("Allocating a 0x%zx bytes resume frame failed", Size);
+            return;
+        }
+    }
+
+    // A double buffered or scroll panned mode shows the rows from Y_OFFSET, the frame is restored to row 0
+    if (!m_HardwareBlt[0].CopyShadowFrame(m_pResumeFrame, BPPFromPixelFormat(pMode->DispInfo.ColorFormat), pMode)) {
+        RtlCopyMemory(
+            m_pResumeFrame,
+            reinterpret_cast<BYTE *>(pMode->FrameBuffer.Ptr) +
+                (SIZE_T)m_ResumeDispi[VBE_DISPI_INDEX_Y_OFFSET] * pMode->DispInfo.Pitch,
+            Size);
+    }
+    m_ResumeDispi[VBE_DISPI_INDEX_Y_OFFSET] = 0;
+
+    m_ResumeMode = *pMode;
+    m_ResumePending = TRUE;
+}
+
+BOOLEAN BASIC_DISPLAY_DRIVER::FastResume()
+/*++
+
+  Routine Description:
+
+    The method restores the DISPI registers and the mode of source 0 saved
+    by SaveResumeState, and repaints the visible frame from its copy. The
+    frame buffer mapping survives D3, only the device lost its registers and
+    possibly video memory. Change detection still describes the restored
+    frame, but the other frames of a double buffered or scroll panned mode
+    are unknown.
+
+  Arguments:
+
+    None
+
+  Return Value:
+
+    FALSE if nothing was saved or the mode could not be restored
+
+--*/
+{
+    PAGED_CODE();
+
+    if (!m_ResumePending) {
+        return FALSE;
+    }
+    m_ResumePending = FALSE;
+
+    if (!NT_SUCCESS(RestoreVBEState(m_ResumeDispi))) {
+        return FALSE;
+    }
+
+    // DxgkCbAcquirePostDisplayOwnership replaced the display information with the firmware mode
+    m_CurrentModes[0] = m_ResumeMode;
+    m_CurrentModes[0].ZeroedOutStart.QuadPart = 0;
+    m_CurrentModes[0].ZeroedOutEnd.QuadPart = 0;
+    RtlCopyMemory(
+        m_CurrentModes[0].FrameBuffer.Ptr,
+        m_pResumeFrame,
+        (SIZE_T)m_CurrentModes[0].DispInfo.Pitch * m_CurrentModes[0].DispInfo.Height);
+    m_HardwareBlt[0].ResetFlip();
+
+    return TRUE;
+}
+
 NTSTATUS BASIC_DISPLAY_DRIVER::QueryChildRelations(
     _Out_writes_bytes_(ChildRelationsSize) DXGK_CHILD_DESCRIPTOR *pChildRelations,
     _In_ ULONG ChildRelationsSize) {
@@ -299,7 +518,8 @@ NTSTATUS BASIC_DISPLAY_DRIVER::QueryAdapterInfo(_In_ CONST DXGKARG_QUERYADAPTERI
 
         // Nearly all fields must be initialized to zero, so zero out to start and then change those that are non-zero.
         // Fields are zero since BDD is Display-Only and therefore does not support any of the render related fields.
-        // It also doesn't support hardware interrupts, gamma ramps, etc.
+        // It also doesn't support hardware interrupts, gamma ramps, etc. The display-only VSync interrupt is emulated
+        // with a timer and needs no capability.
         RtlZeroMemory(pDriverCaps, sizeof(DXGK_DRIVERCAPS));
 
         pDriverCaps->WDDMVersion = DXGKDDI_WDDMv1_2;
@@ -364,9 +584,21 @@ NTSTATUS BASIC_DISPLAY_DRIVER::PresentDisplayOnly(_In_ CONST DXGKARG_PRESENT_DIS
         return STATUS_INVALID_PARAMETER;
     }
 
-    // If it is in monitor off state or source is not supposed to be visible, don't present anything to the screen
+    // If it is in monitor off state or source is not supposed to be visible, don't present anything to the screen, but
+    // remember what changed to catch up with it once the source is shown again
     if ((m_MonitorPowerState > PowerDeviceD0) ||
         (m_CurrentModes[pPresentDisplayOnly->VidPnSourceId].Flags.SourceNotVisible)) {
+        if (m_CurrentModes[pPresentDisplayOnly->VidPnSourceId].Flags.FrameBufferIsActive) {
+            return m_HardwareBlt[pPresentDisplayOnly->VidPnSourceId].AccumulateDarkPresent(
+                (BYTE *)pPresentDisplayOnly->pSource,
+                pPresentDisplayOnly->Pitch,
+                pPresentDisplayOnly->NumMoves,
+                pPresentDisplayOnly->pMoves,
+                pPresentDisplayOnly->NumDirtyRects,
+                pPresentDisplayOnly->pDirtyRect,
+                pPresentDisplayOnly->Flags.Rotate ? m_CurrentModes[pPresentDisplayOnly->VidPnSourceId].Rotation
+                                                  : D3DKMDT_VPPR_IDENTITY);
+        }
         return STATUS_SUCCESS;
     }
 
@@ -381,18 +613,8 @@ NTSTATUS BASIC_DISPLAY_DRIVER::PresentDisplayOnly(_In_ CONST DXGKARG_PRESENT_DIS
         D3DKMDT_VIDPN_PRESENT_PATH_ROTATION RotationNeededByFb = pPresentDisplayOnly->Flags.Rotate
             ? m_CurrentModes[pPresentDisplayOnly->VidPnSourceId].Rotation
             : D3DKMDT_VPPR_IDENTITY;
-        BYTE *pDst = (BYTE *)m_CurrentModes[pPresentDisplayOnly->VidPnSourceId].FrameBuffer.Ptr;
-        UINT DstBitPerPixel =
-            BPPFromPixelFormat(m_CurrentModes[pPresentDisplayOnly->VidPnSourceId].DispInfo.ColorFormat);
-        if (m_CurrentModes[pPresentDisplayOnly->VidPnSourceId].Scaling == D3DKMDT_VPPS_CENTERED) {
-            UINT CenterShift = (m_CurrentModes[pPresentDisplayOnly->VidPnSourceId].DispInfo.Height -
-                                m_CurrentModes[pPresentDisplayOnly->VidPnSourceId].SrcModeHeight) *
-                m_CurrentModes[pPresentDisplayOnly->VidPnSourceId].DispInfo.Pitch;
-            CenterShift += (m_CurrentModes[pPresentDisplayOnly->VidPnSourceId].DispInfo.Width -
-                            m_CurrentModes[pPresentDisplayOnly->VidPnSourceId].SrcModeWidth) *
-                DstBitPerPixel / BITS_PER_BYTE;
-            pDst += (int)CenterShift / 2;
-        }
+        UINT DstBitPerPixel;
+        BYTE *pDst = GetPresentDst(pPresentDisplayOnly->VidPnSourceId, &DstBitPerPixel);
         return m_HardwareBlt[pPresentDisplayOnly->VidPnSourceId].ExecutePresentDisplayOnly(
             pDst,
             DstBitPerPixel,
@@ -409,6 +631,40 @@ NTSTATUS BASIC_DISPLAY_DRIVER::PresentDisplayOnly(_In_ CONST DXGKARG_PRESENT_DIS
     return STATUS_SUCCESS;
 }
 
+BYTE *BASIC_DISPLAY_DRIVER::GetPresentDst(D3DDDI_VIDEO_PRESENT_SOURCE_ID SourceId, _Out_ UINT *pDstBitPerPixel) const {
+    PAGED_CODE();
+
+    BYTE *pDst = (BYTE *)m_CurrentModes[SourceId].FrameBuffer.Ptr;
+    UINT DstBitPerPixel = BPPFromPixelFormat(m_CurrentModes[SourceId].DispInfo.ColorFormat);
+    if (m_CurrentModes[SourceId].Scaling == D3DKMDT_VPPS_CENTERED) {
+        UINT CenterShift = (m_CurrentModes[SourceId].DispInfo.Height - m_CurrentModes[SourceId].SrcModeHeight) *
+            m_CurrentModes[SourceId].DispInfo.Pitch;
+        CenterShift += (m_CurrentModes[SourceId].DispInfo.Width - m_CurrentModes[SourceId].SrcModeWidth) *
+            DstBitPerPixel / BITS_PER_BYTE;
+        pDst += (int)CenterShift / 2;
+    }
+
+    *pDstBitPerPixel = DstBitPerPixel;
+    return pDst;
+}
+
+VOID BASIC_DISPLAY_DRIVER::CatchUpDarkPresents(D3DDDI_VIDEO_PRESENT_SOURCE_ID SourceId) {
+    PAGED_CODE();
+
+    if (SourceId >= MAX_VIEWS || m_MonitorPowerState > PowerDeviceD0 ||
+        m_CurrentModes[SourceId].Flags.SourceNotVisible || !m_CurrentModes[SourceId].Flags.FrameBufferIsActive) {
+        return;
+    }
+
+    // Like a present, the copy makes BlackOutScreen zero the frame buffer again
+    m_CurrentModes[SourceId].ZeroedOutStart.QuadPart = 0;
+    m_CurrentModes[SourceId].ZeroedOutEnd.QuadPart = 0;
+
+    UINT DstBitPerPixel;
+    BYTE *pDst = GetPresentDst(SourceId, &DstBitPerPixel);
+    m_HardwareBlt[SourceId].CatchUpDarkPresents(pDst, DstBitPerPixel);
+}
+
 NTSTATUS BASIC_DISPLAY_DRIVER::StopDeviceAndReleasePostDisplayOwnership(
     _In_ D3DDDI_VIDEO_PRESENT_TARGET_ID TargetId,
     _Out_ DXGK_DISPLAY_INFORMATION *pDisplayInfo) {
@@ -418,6 +674,8 @@ NTSTATUS BASIC_DISPLAY_DRIVER::StopDeviceAndReleasePostDisplayOwnership(
 
     D3DDDI_VIDEO_PRESENT_SOURCE_ID SourceId = FindSourceForTarget(TargetId, TRUE);
 
+    WaitForPresents();
+
     // In case BDD is the next driver to run, the monitor should not be off, since
     // this could cause the BIOS to hang when the EDID is retrieved on Start.
     if (m_MonitorPowerState > PowerDeviceD0) {
@@ -459,38 +717,47 @@ VOID BASIC_DISPLAY_DRIVER::BlackOutScreen(D3DDDI_VIDEO_PRESENT_SOURCE_ID SourceI
     PHYSICAL_ADDRESS NewPhysAddrEnd;
     NewPhysAddrEnd.QuadPart = NewPhysAddrStart.QuadPart + (ScreenHeight * ScreenPitch);
 
+    // Whatever the frame buffer held is either zeroed now or unknown
+    m_HardwareBlt[SourceId].ResetChangeDetection(m_CurrentModes[SourceId].Flags.FrameBufferIsActive);
+
+    // Only the first frame is blacked out, and the next driver or the firmware expects it on screen
+    if (m_CurrentModes[SourceId].Flags.DoubleBuffered || m_CurrentModes[SourceId].Flags.ScrollPanned) {
+        PanFrameBuffer(SourceId, 0);
+    }
+    m_HardwareBlt[SourceId].ResetFlip();
+
     if (m_CurrentModes[SourceId].Flags.FrameBufferIsActive) {
         BYTE *MappedAddr = reinterpret_cast<BYTE *>(m_CurrentModes[SourceId].FrameBuffer.Ptr);
 
-        // Zero any memory at the start that hasn't been zeroed recently
-        if (NewPhysAddrStart.QuadPart < m_CurrentModes[SourceId].ZeroedOutStart.QuadPart) {
-            if (NewPhysAddrEnd.QuadPart < m_CurrentModes[SourceId].ZeroedOutStart.QuadPart) {
-                // No overlap
-                RtlZeroMemory(MappedAddr, ScreenHeight * ScreenPitch);
-            } else {
-                RtlZeroMemory(
-                    MappedAddr,
-                    (UINT)(m_CurrentModes[SourceId].ZeroedOutStart.QuadPart - NewPhysAddrStart.QuadPart));
-            }
+        // Mode sets keep video memory, so only what is visible and hasn't been zeroed since is cleared
+        // NOTE: When actual pixels were the most recent thing drawn, ZeroedOutStart & ZeroedOutEnd will both be 0 and
+        // the whole screen is zeroed.
+        LONGLONG ZeroedStart = max(NewPhysAddrStart.QuadPart, m_CurrentModes[SourceId].ZeroedOutStart.QuadPart);
+        LONGLONG ZeroedEnd = min(NewPhysAddrEnd.QuadPart, m_CurrentModes[SourceId].ZeroedOutEnd.QuadPart);
+        if (ZeroedStart >= ZeroedEnd) {
+            // No overlap
+            BltZeroFrame(MappedAddr, (SIZE_T)ScreenHeight * ScreenPitch);
+        } else {
+            // Zero any memory at the start and at the end that hasn't been zeroed recently
+            BltZeroFrame(MappedAddr, (SIZE_T)(ZeroedStart - NewPhysAddrStart.QuadPart));
+            BltZeroFrame(
+                MappedAddr + (ZeroedEnd - NewPhysAddrStart.QuadPart),
+                (SIZE_T)(NewPhysAddrEnd.QuadPart - ZeroedEnd));
         }
 
-        // Zero any memory at the end that hasn't been zeroed recently
-        if (NewPhysAddrEnd.QuadPart > m_CurrentModes[SourceId].ZeroedOutEnd.QuadPart) {
-            if (NewPhysAddrStart.QuadPart > m_CurrentModes[SourceId].ZeroedOutEnd.QuadPart) {
-                // No overlap
-                // NOTE: When actual pixels were the most recent thing drawn, ZeroedOutStart & ZeroedOutEnd will both be
-                // 0 and this is the path that will be used to black out the current screen.
-                RtlZeroMemory(MappedAddr, ScreenHeight * ScreenPitch);
-            } else {
-                RtlZeroMemory(
-                    MappedAddr,
-                    (UINT)(NewPhysAddrEnd.QuadPart - m_CurrentModes[SourceId].ZeroedOutEnd.QuadPart));
-            }
-        }
+        m_CurrentModes[SourceId].ZeroedOutStart.QuadPart = NewPhysAddrStart.QuadPart;
+        m_CurrentModes[SourceId].ZeroedOutEnd.QuadPart = NewPhysAddrEnd.QuadPart;
+    } else {
+        // Nothing was zeroed, and the device no longer clears video memory on mode sets
+        m_CurrentModes[SourceId].ZeroedOutStart.QuadPart = 0;
+        m_CurrentModes[SourceId].ZeroedOutEnd.QuadPart = 0;
     }
+}
 
-    m_CurrentModes[SourceId].ZeroedOutStart.QuadPart = NewPhysAddrStart.QuadPart;
-    m_CurrentModes[SourceId].ZeroedOutEnd.QuadPart = NewPhysAddrEnd.QuadPart;
+VOID BASIC_DISPLAY_DRIVER::FlipFrameBuffer(D3DDDI_VIDEO_PRESENT_SOURCE_ID SourceId, UINT Frame) {
+    PAGED_CODE();
+
+    PanFrameBuffer(SourceId, Frame * m_CurrentModes[SourceId].DispInfo.Height);
 }
 
 UINT BASIC_DISPLAY_DRIVER::FindMatchingVBEMode(CONST D3DKMDT_VIDPN_SOURCE_MODE *pSourceMode) const {
@@ -546,6 +813,97 @@ BASIC_DISPLAY_DRIVER::WriteHWInfoStr(_In_ HANDLE DevInstRegKeyHandle, _In_ PCWST
     return Status;
 }
 
+// Returns TRUE and the value if the key has a REG_DWORD value of that name
+static BOOLEAN ReadDwordValue(_In_ HANDLE KeyHandle, _In_ PCWSTR pszwValueName, _Out_ DWORD *pData) {
+    PAGED_CODE();
+
+    UNICODE_STRING ValueName;
+    RtlInitUnicodeString(&ValueName, pszwValueName);
+
+    BYTE Buffer[sizeof(KEY_VALUE_PARTIAL_INFORMATION) + sizeof(DWORD)];
+    KEY_VALUE_PARTIAL_INFORMATION *pValue = reinterpret_cast<KEY_VALUE_PARTIAL_INFORMATION *>(Buffer);
+    ULONG ResultLength;
+    NTSTATUS Status =
+        ZwQueryValueKey(KeyHandle, &ValueName, KeyValuePartialInformation, pValue, sizeof(Buffer), &ResultLength);
+    if (!NT_SUCCESS(Status) || pValue->Type != REG_DWORD || pValue->DataLength != sizeof(DWORD)) {
+        return FALSE;
+    }
+
+    *pData = *reinterpret_cast<UNALIGNED DWORD *>(pValue->Data);
+    return TRUE;
+}
+
+VOID BASIC_DISPLAY_DRIVER::ReadConfiguration() {
+    PAGED_CODE();
+
+    HANDLE DevInstRegKeyHandle;
+    NTSTATUS Status =
+        IoOpenDeviceRegistryKey(m_pPhysicalDevice, PLUGPLAY_REGKEY_DRIVER, KEY_QUERY_VALUE, &DevInstRegKeyHandle);
+    if (!NT_SUCCESS(Status)) {
+        BDD_LOG_ERROR("IoOpenDeviceRegistryKey failed for PDO: 0x%p, Status: 0x%x", m_pPhysicalDevice, Status);
+        return;
+    }
+
+    DWORD Value;
+    if (ReadDwordValue(DevInstRegKeyHandle, L"ChangeDetection", &Value)) {
+        if (Value <= BDD_CHANGE_DETECTION_ADAPTIVE) {
+            m_ChangeDetection = static_cast<BDD_CHANGE_DETECTION>(Value);
+        } else {
+            BDD_LOG_WARNING("Ignoring unknown ChangeDetection value %lu", Value);
+        }
+    }
+
+    if (ReadDwordValue(DevInstRegKeyHandle, L"DoubleBuffer", &Value)) {
+        m_DoubleBuffer = Value != 0;
+    }
+
+    if (ReadDwordValue(DevInstRegKeyHandle, L"ScrollPanning", &Value)) {
+        m_ScrollPanning = Value != 0;
+    }
+
+    if (ReadDwordValue(DevInstRegKeyHandle, L"PresentRate", &Value)) {
+        if (Value <= 1000) {
+            m_PresentRate = Value;
+        } else {
+            BDD_LOG_WARNING("Ignoring PresentRate value %lu, above 1000 presents per second", Value);
+        }
+    }
+
+    if (ReadDwordValue(DevInstRegKeyHandle, L"WriteBudget", &Value)) {
+        m_WriteBudget = Value;
+    }
+
+    if (ReadDwordValue(DevInstRegKeyHandle, L"DeferredFlushInterval", &Value)) {
+        if (Value <= 1000) {
+            m_DeferredFlushInterval = Value;
+        } else {
+            BDD_LOG_WARNING("Ignoring DeferredFlushInterval value %lu, above 1000 milliseconds", Value);
+        }
+    }
+
+    if (ReadDwordValue(DevInstRegKeyHandle, L"FastResume", &Value)) {
+        m_FastResume = Value != 0;
+    }
+
+    if (ReadDwordValue(DevInstRegKeyHandle, L"SeamlessBoot", &Value)) {
+        m_SeamlessBoot = Value != 0;
+    }
+
+    ZwClose(DevInstRegKeyHandle);
+
+    BDD_LOG_INFO(
+        "Change detection %u, double buffering %u, scroll panning %u, present rate %lu, write budget %lu bytes/s, "
+        "deferred flush interval %lu ms, fast resume %u, seamless boot %u",
+        m_ChangeDetection,
+        m_DoubleBuffer,
+        m_ScrollPanning,
+        m_PresentRate,
+        m_WriteBudget,
+        m_DeferredFlushInterval,
+        m_FastResume,
+        m_SeamlessBoot);
+}
+
 NTSTATUS BASIC_DISPLAY_DRIVER::RegisterHWInfo() {
     PAGED_CODE();
 
@@ -622,10 +980,82 @@ VOID BASIC_DISPLAY_DRIVER::DpcRoutine(VOID) {
 BOOLEAN BASIC_DISPLAY_DRIVER::InterruptRoutine(_In_ ULONG MessageNumber) {
     UNREFERENCED_PARAMETER(MessageNumber);
 
-    // BDD cannot handle interrupts
+    // BDD cannot handle interrupts, VSync is reported by VSyncTimerCallback
     return FALSE;
 }
 
+// May be called at DISPATCH_LEVEL
+NTSTATUS BASIC_DISPLAY_DRIVER::ControlInterrupt(
+    _In_ CONST DXGK_INTERRUPT_TYPE InterruptType,
+    _In_ BOOLEAN EnableInterrupt) {
+    if (InterruptType != DXGK_INTERRUPT_DISPLAYONLY_VSYNC) {
+        return STATUS_NOT_IMPLEMENTED;
+    }
+    if (m_pVSyncTimer == NULL) {
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    m_VSyncInterrupt = EnableInterrupt;
+    UpdateVSyncTimer();
+    return STATUS_SUCCESS;
+}
+
+VOID BASIC_DISPLAY_DRIVER::UpdateVSyncTimer() {
+    if (m_pVSyncTimer == NULL) {
+        return;
+    }
+
+    BOOLEAN Run = m_PresentRate != 0 || m_VSyncInterrupt;
+    if (Run == m_VSyncTimerSet) {
+        return;
+    }
+
+    if (Run) {
+        // Paced presents tick at their rate, which VSync follows so that DWM composes at the rate presents are shown
+        LONGLONG Period = 10000000LL / ((m_PresentRate != 0) ? m_PresentRate : BDD_VSYNC_RATE);
+        ExSetTimer(m_pVSyncTimer, -Period, Period, NULL);
+    } else {
+        ExCancelTimer(m_pVSyncTimer, NULL);
+    }
+    m_VSyncTimerSet = Run;
+}
+
+// Called at DISPATCH_LEVEL on every tick of the VSync timer
+VOID BASIC_DISPLAY_DRIVER::VSyncTimerCallback(_In_ PEX_TIMER Timer, _In_opt_ PVOID Context) {
+    UNREFERENCED_PARAMETER(Timer);
+
+    BASIC_DISPLAY_DRIVER *pBDD = reinterpret_cast<BASIC_DISPLAY_DRIVER *>(Context);
+
+    for (UINT i = 0; i < MAX_VIEWS; i++) {
+        pBDD->m_HardwareBlt[i].SignalPresentTick();
+    }
+
+    if (pBDD->m_VSyncInterrupt) {
+        // DxgkCbNotifyInterrupt must be called as if from the interrupt routine, and followed by a DPC
+        BOOLEAN Ret;
+        pBDD->m_DxgkInterface
+            .DxgkCbSynchronizeExecution(pBDD->m_DxgkInterface.DeviceHandle, NotifyVSync, pBDD, 0, &Ret);
+        pBDD->m_DxgkInterface.DxgkCbQueueDpc(pBDD->m_DxgkInterface.DeviceHandle);
+    }
+}
+
+BOOLEAN BASIC_DISPLAY_DRIVER::NotifyVSync(_In_opt_ PVOID SynchronizeContext) {
+    BASIC_DISPLAY_DRIVER *pBDD = reinterpret_cast<BASIC_DISPLAY_DRIVER *>(SynchronizeContext);
+
+    for (UINT SourceId = 0; SourceId < MAX_VIEWS; SourceId++) {
+        if (!pBDD->m_CurrentModes[SourceId].Flags.FrameBufferIsActive) {
+            continue;
+        }
+
+        DXGKARGCB_NOTIFY_INTERRUPT_DATA NotifyInterrupt;
+        RtlZeroMemory(&NotifyInterrupt, sizeof(NotifyInterrupt));
+        NotifyInterrupt.InterruptType = DXGK_INTERRUPT_DISPLAYONLY_VSYNC;
+        NotifyInterrupt.DisplayOnlyVsync.VidPnSourceId = SourceId;
+        pBDD->m_DxgkInterface.DxgkCbNotifyInterrupt(pBDD->m_DxgkInterface.DeviceHandle, &NotifyInterrupt);
+    }
+    return TRUE;
+}
+
 VOID BASIC_DISPLAY_DRIVER::ResetDevice(VOID) {}
 
 // Must be Non-Paged, as it sets up the display for a bugcheck
@@ -670,6 +1100,13 @@ NTSTATUS BASIC_DISPLAY_DRIVER::SystemDisplayEnable(
 
     *pColorFormat = m_CurrentModes[m_SystemDisplaySourceId].DispInfo.ColorFormat;
 
+    // The bugcheck screen is written to the first frame. m_DispiLock is not taken, the system is stopped and its holder
+    // may never run again.
+    if (m_CurrentModes[m_SystemDisplaySourceId].Flags.DoubleBuffered ||
+        m_CurrentModes[m_SystemDisplaySourceId].Flags.ScrollPanned) {
+        DispiWriteUShort(VBE_DISPI_INDEX_Y_OFFSET, 0);
+    }
+
     return STATUS_SUCCESS;
 }
 
@@ -717,6 +1154,17 @@ VOID BASIC_DISPLAY_DRIVER::SystemDisplayWrite(
         &SrcBltInfo,
         1, // NumRects
         &Rect);
+    BltFlush();
+}
+
+VOID BASIC_DISPLAY_DRIVER::PanFrameBuffer(D3DDDI_VIDEO_PRESENT_SOURCE_ID SourceId, UINT Row) {
+    BDD_ASSERT(Row + m_CurrentModes[SourceId].DispInfo.Height <= m_CurrentModes[SourceId].VirtualHeight);
+
+    // A single register write, so the host scans out either the whole previous frame or the whole new one
+    KIRQL OldIrql;
+    KeAcquireSpinLock(&m_DispiLock, &OldIrql);
+    DispiWriteUShort(VBE_DISPI_INDEX_Y_OFFSET, (USHORT)Row);
+    KeReleaseSpinLock(&m_DispiLock, OldIrql);
 }
 
 #pragma code_seg(pop) // End Non-Paged Code
@@ -49,6 +49,7 @@ extern "C" {
 #define EDID_V1_BLOCK_SIZE 128
 
 #include "bdd_errorlog.hxx"
+#include "bdd_region.hxx"
 #include "bdd_vbe.hxx"
 
 #define MIN_BYTES_PER_PIXEL_REPORTED 4
@@ -103,6 +104,9 @@ typedef struct _CURRENT_BDD_MODE {
     UINT SrcModeWidth;
     UINT SrcModeHeight;
 
+    // Rows of video memory set as the virtual height of the VBE mode, the visible frame can start at any of them
+    UINT VirtualHeight;
+
     // Various boolean flags the struct uses
     struct _CURRENT_BDD_MODE_FLAGS {
         UINT SourceNotVisible : 1;    // 0 if source is visible
@@ -110,7 +114,9 @@ typedef struct _CURRENT_BDD_MODE {
         UINT FrameBufferIsActive : 1; // 0 if not currently active (i.e. target not connected to source)
         UINT DoNotMapOrUnmap : 1;     // 1 if the FrameBuffer should not be (un)mapped during normal execution
         UINT IsInternal : 1; // 1 if it was determined (i.e. through ACPI) that an internal panel is being driven
-        UINT Unused : 27;
+        UINT DoubleBuffered : 1; // 1 if the frame buffer holds a back frame after the front one, flipped with Y_OFFSET
+        UINT ScrollPanned : 1;   // 1 if vertical scrolls move the visible frame within VirtualHeight with Y_OFFSET
+        UINT Unused : 25;
     } Flags;
 
     // The start and end of physical memory known to be all zeroes. Used to optimize the BlackOutScreen function to not
@@ -127,8 +133,143 @@ typedef struct _CURRENT_BDD_MODE {
     } FrameBuffer;
 } CURRENT_BDD_MODE;
 
+// Size of the frame buffer mapping of a mode, which covers the whole virtual height when Y_OFFSET is used
+inline ULONG GetFrameBufferMappingSize(CONST CURRENT_BDD_MODE *pMode) {
+    UINT Rows = (pMode->Flags.DoubleBuffered || pMode->Flags.ScrollPanned) ? pMode->VirtualHeight
+                                                                            : pMode->DispInfo.Height;
+    return pMode->DispInfo.Pitch * Rows;
+}
+
 class BASIC_DISPLAY_DRIVER;
 
+// How presents find the pixels that actually changed, selected by the ChangeDetection registry value of the device
+typedef enum _BDD_CHANGE_DETECTION {
+    BDD_CHANGE_DETECTION_NONE = 0,      // Every pixel of the dirty rects is written
+    BDD_CHANGE_DETECTION_SHADOW = 1,    // Dirty rects are compared against a system memory copy of the frame buffer
+    BDD_CHANGE_DETECTION_TILE_HASH = 2, // Tiles touched by dirty rects are compared by hash, using little memory
+    BDD_CHANGE_DETECTION_ADAPTIVE = 3,  // Each tile is compared or copied directly, whichever it measured cheaper
+} BDD_CHANGE_DETECTION;
+
+// Size in pixels of the square tiles of BDD_CHANGE_DETECTION_TILE_HASH and BDD_CHANGE_DETECTION_ADAPTIVE
+#define BDD_TILE_SIZE 64
+
+// Presents a tile is copied directly by BDD_CHANGE_DETECTION_ADAPTIVE before it is compared again, to keep its change
+// ratio current
+#define BDD_TILE_PROBE_INTERVAL 16
+
+// Present policy state of a tile of BDD_CHANGE_DETECTION_ADAPTIVE
+typedef struct _BDD_TILE_POLICY {
+    UCHAR ChangeRatio; // Moving average of the part of the tile its compared presents changed, in 1/256
+    UCHAR Probe;       // Presents of the tile copied directly since it was last compared
+    BOOLEAN Stale;     // The shadow of the tile was not updated by the presents copied directly
+    BOOLEAN Deferred;  // The last flush left the damage of the tile to the next one
+    ULONG LastFlush;   // Sequence number of the last flush that wrote the tile
+} BDD_TILE_POLICY;
+
+// Smallest change detection output allocated, in rects
+#define BDD_MIN_DAMAGE_RECTS 256
+
+// Number of the last merged rects of a present that a new rect is compared with
+#define BDD_MERGE_WINDOW 8
+
+// Presents with more rects than this are copied in the order they were sent, as building their region is quadratic
+#define BDD_SCHEDULE_MAX_RECTS 512
+
+// Virtual height of a scroll panned mode in visible heights, limiting how much video memory is mapped
+#define BDD_PAN_FRAMES 4
+
+// Number of locked source surfaces kept mapped by each source
+#define BDD_SOURCE_CACHE_SIZE 4
+
+// A source surface locked and mapped into system space, reused by the presents of the same surface
+typedef struct _BDD_SOURCE_MAPPING {
+    PEPROCESS Process;
+    BYTE *UserAddr;
+    LONG Pitch;
+    SIZE_T Size;
+    PMDL Mdl; // NULL if the entry is free
+    BYTE *SystemAddr;
+    ULONG References; // Presents using the mapping
+    BOOLEAN Stale;    // Invalidated while referenced, unlocked by the last release
+    ULONG64 LastUse;
+} BDD_SOURCE_MAPPING;
+
+typedef struct _DO_PRESENT_MEMORY {
+    PVOID DstAddr;
+    UINT DstStride;
+    ULONG DstBitPerPixel;
+    ULONG DstFrameSize; // Offset of the second frame when double buffered, 0 otherwise
+    UINT DstPanRows;    // Rows the visible frame can be panned over when scroll panned, 0 otherwise
+    UINT SrcWidth;
+    UINT SrcHeight;
+    BYTE *SrcAddr;
+    LONG SrcPitch;
+    BDD_SOURCE_MAPPING *pMapping; // Cached mapping SrcAddr belongs to
+    PMDL Mdl;                     // Locks the pages of SrcAddr when it is an uncached mapping
+    ULONG NumMoves;                // in:  Number of screen to screen moves
+    CONST D3DKMT_MOVE_RECT *Moves; // in:  Point to the list of moves
+    ULONG NumDirtyRects;           // in:  Number of direct rects
+    CONST RECT *DirtyRect;         // in:  Point to the list of dirty rects
+    D3DKMDT_VIDPN_PRESENT_PATH_ROTATION Rotation;
+    D3DDDI_VIDEO_PRESENT_SOURCE_ID SourceID;
+    HANDLE hAdapter;
+    class BDD_HWBLT *DisplaySource;
+} DO_PRESENT_MEMORY, *PDO_PRESENT_MEMORY;
+
+// Counters of the present path, logged every BDD_PRESENT_STATS_INTERVAL presents
+typedef struct _BDD_PRESENT_STATS {
+    ULONG64 Presents;
+    ULONG64 Allocations; // Pool allocations made by presents, constant once the present path is warm
+    ULONG64 SourceCacheHits;
+    ULONG64 SourceCacheMisses;
+    ULONG64 SourceLockFailures; // Presents executed from the user-mode address as their source could not be locked
+    ULONG64 ScheduledPresents;
+    ULONG64 PagesWritten; // Distinct frame buffer pages written by the scheduled presents
+    ULONG64 RectsMerged;
+    ULONG64 CopyTicks; // Performance counter ticks spent finding changes and copying
+    ULONG64 ScrollsPanned;
+    ULONG64 PanRebases;        // Panned scrolls that ran out of rows and copied the whole frame
+    ULONG64 PresentsCoalesced; // Paced presents executed together with a later one
+    ULONG64 ThrottledBytes;    // Damage of the presents that waited for the write budget
+    ULONG64 ThrottleTicks;     // Performance counter ticks presents waited for the write budget
+    ULONG64 DeferredFlushes;   // Flushes of the deferred I/O back buffer that wrote some damage
+    ULONG64 TilesCompared;     // Tile parts compared against the shadow by the adaptive policy
+    ULONG64 TilesCopied;       // Tile parts copied directly by the adaptive policy
+    ULONG64 TilesDeferred;     // Tile parts left by a flush to the next one by the adaptive policy
+    ULONG64 DarkPresents;      // Presents accumulated while the monitor was off or the source invisible
+    ULONG64 DarkCatchUps;      // Presents of the accumulated damage once the source was shown again
+} BDD_PRESENT_STATS;
+
+#define BDD_PRESENT_STATS_INTERVAL 4096
+
+// Presents queued to the worker of a source before PresentDisplayOnly blocks for a free entry
+#define BDD_PRESENT_QUEUE_DEPTH 4
+
+// Priority of the present workers and band threads: the top of the dynamic range, above the threads of the desktop
+// but below the real-time ones, which a full screen copy would otherwise hold off for milliseconds
+#define BDD_PRESENT_THREAD_PRIORITY (LOW_REALTIME_PRIORITY - 1)
+
+// Rate of the emulated VSync interrupt when presents are not paced
+#define BDD_VSYNC_RATE 60
+
+// Longest a paced present waits for a tick, in case the timer is stopped while presents are queued
+#define BDD_PACING_TIMEOUT_MS 1000
+
+// Bytes a source may write at once under a write budget, in milliseconds of the budget
+#define BDD_BUDGET_BURST_MS 250
+
+// Smallest rect store allocated for a queued present
+#define BDD_PRESENT_MIN_RECTS 16
+
+// A present waiting for the worker thread. The rect stores belong to the entry and only grow.
+typedef struct _BDD_PRESENT_ENTRY {
+    DO_PRESENT_MEMORY Present;
+    D3DKMT_MOVE_RECT *pMoveStore;
+    ULONG MoveCapacity;
+    RECT *pDirtyRectStore;
+    ULONG DirtyRectCapacity;
+} BDD_PRESENT_ENTRY;
+
 class BDD_HWBLT {
 public:
     D3DDDI_VIDEO_PRESENT_SOURCE_ID m_SourceId;
@@ -153,6 +294,276 @@ public:
         _In_ ULONG NumDirtyRects,
         _In_ RECT *pDirtyRect,
         _In_ D3DKMDT_VIDPN_PRESENT_PATH_ROTATION Rotation);
+
+    // Starts the present worker thread, without it presents are executed synchronously. A paced worker executes the
+    // presents queued between two ticks of the VSync timer at once. A nonzero write budget limits the bytes of damage
+    // written per second. A nonzero flush interval turns the worker into the flush thread of deferred I/O.
+    NTSTATUS StartPresentWorker(BOOLEAN Paced, ULONG WriteBudget, ULONG FlushInterval);
+
+    // Completes the queued presents and stops the present worker thread
+    VOID StopPresentWorker();
+
+    // Waits until all the queued presents have been written to the frame buffer
+    VOID WaitForPresents();
+
+    // Unlocks the cached source mappings of Process, or of all processes if NULL. Returns TRUE if some are still used
+    // by queued presents, they are then unlocked once these complete.
+    BOOLEAN InvalidateSourceCache(_In_opt_ PEPROCESS Process);
+
+    // Registers the process notification that drops the cached source mappings of exiting processes. If this fails
+    // the source surfaces are locked for each present instead of being cached.
+    static VOID RegisterProcessNotify();
+    static VOID UnregisterProcessNotify();
+
+    // Allocates the deferred I/O back buffer for the mode just committed, if the worker flushes one
+    VOID AllocateBackBuffer(_In_ CONST CURRENT_BDD_MODE *pMode);
+
+    // Allocates the change detection state for the mode just committed, must be followed by ResetChangeDetection
+    VOID AllocateChangeDetection(BDD_CHANGE_DETECTION Mode, _In_ CONST CURRENT_BDD_MODE *pMode);
+    VOID FreeChangeDetection();
+
+    // Called whenever the frame buffer is written outside of presents. If it was zeroed the change detection state is
+    // reset to match, otherwise change detection stays off until a present covers the whole source.
+    VOID ResetChangeDetection(BOOLEAN FrameBufferZeroed);
+
+    // Forgets what the frames of a double buffered or scroll panned frame buffer hold, after a mode set or blackout
+    // shows row 0
+    VOID ResetFlip();
+
+    // Draws the visible frame from the shadow in the layout of the frame buffer, returns FALSE if there is no shadow
+    // known to match it
+    BOOLEAN CopyShadowFrame(_Out_ BYTE *pDst, UINT DstBitPerPixel, _In_ CONST CURRENT_BDD_MODE *pMode);
+
+    // While the monitor is off or the source invisible, presents only add their rects to the dark damage and keep the
+    // latest source surface locked. Once the source is shown again, the damage is copied by a single present.
+    NTSTATUS AccumulateDarkPresent(
+        _In_ BYTE *SrcAddr,
+        _In_ LONG SrcPitch,
+        _In_ ULONG NumMoves,
+        _In_ D3DKMT_MOVE_RECT *Moves,
+        _In_ ULONG NumDirtyRects,
+        _In_ RECT *DirtyRect,
+        _In_ D3DKMDT_VIDPN_PRESENT_PATH_ROTATION Rotation);
+    VOID CatchUpDarkPresents(_In_ BYTE *DstAddr, _In_ UINT DstBitPerPixel);
+
+    // Forgets the dark presents, or only unlocks the dark source if it belongs to Process, an exiting process whose
+    // surface must not stay locked. The damage is then lost and the next catch up copies the whole source.
+    VOID DiscardDarkPresents(_In_opt_ PEPROCESS Process);
+
+#pragma code_seg(push)
+#pragma code_seg()
+    // Called by the VSync timer at DISPATCH_LEVEL
+    VOID SignalPresentTick() {
+        KeSetEvent(&m_PresentTickEvent, IO_NO_INCREMENT, FALSE);
+    }
+#pragma code_seg(pop)
+
+private:
+    static KSTART_ROUTINE PresentWorkerThread;
+    VOID PresentWorker();
+    UINT WaitForPresentTick();
+    UINT WaitForWriteBudget(UINT NumPresents);
+    ULONGLONG GetQueuedDamage(UINT NumPresents);
+    BOOLEAN CoalescePresents(UINT NumPresents);
+
+    // Deferred I/O: presents are copied to the back buffer, and the flush thread writes their damage
+    NTSTATUS DeferPresent(
+        _In_ BYTE *DstAddr,
+        _In_ UINT DstBitPerPixel,
+        _In_ BYTE *SrcAddr,
+        _In_ LONG SrcPitch,
+        _In_ ULONG NumMoves,
+        _In_reads_opt_(NumMoves) CONST D3DKMT_MOVE_RECT *pMoves,
+        _In_ ULONG NumDirtyRects,
+        _In_reads_opt_(NumDirtyRects) CONST RECT *pDirtyRect,
+        _In_ D3DKMDT_VIDPN_PRESENT_PATH_ROTATION Rotation);
+    VOID FlushWorker();
+    VOID FlushBackBuffer(BOOLEAN MayDefer);
+
+    VOID HwExecutePresentDisplayOnly(_Inout_ PDO_PRESENT_MEMORY Context);
+
+    // Reduces the rects of a present to the spans that changed, returns FALSE to copy the present as is
+    BOOLEAN DetectChanges(
+        _In_ PDO_PRESENT_MEMORY Context,
+        CONST BLT_INFO *pSrc,
+        _Outptr_result_buffer_(*pNumRects) CONST RECT **ppRects,
+        _Out_ UINT *pNumRects);
+    BOOLEAN DetectShadowChanges(
+        _In_ PDO_PRESENT_MEMORY Context,
+        CONST BLT_INFO *pSrc,
+        _Outptr_result_buffer_(*pNumRects) CONST RECT **ppRects,
+        _Out_ UINT *pNumRects);
+    BOOLEAN DetectTileChanges(
+        _In_ PDO_PRESENT_MEMORY Context,
+        CONST BLT_INFO *pSrc,
+        _Outptr_result_buffer_(*pNumRects) CONST RECT **ppRects,
+        _Out_ UINT *pNumRects);
+    BOOLEAN DetectAdaptiveChanges(
+        _In_ PDO_PRESENT_MEMORY Context,
+        CONST BLT_INFO *pSrc,
+        _Outptr_result_buffer_(*pNumRects) CONST RECT **ppRects,
+        _Out_ UINT *pNumRects);
+    VOID SetTilesStale(BOOLEAN Stale);
+
+    // Forgets what change detection knows of the rects of a present whose copy faulted
+    VOID InvalidatePresentRects(_In_ PDO_PRESENT_MEMORY Context, CONST BLT_INFO *pSrc);
+
+    // Feeds the time spent writing the pixels of a present to the adaptive policy
+    VOID MeasureCopyCost(LONGLONG Pixels, LONGLONG Ticks);
+
+    // Grows m_pDamage for a present of NumInputRects rects
+    BOOLEAN ReserveDamage(UINT NumInputRects);
+
+    // Merges nearby rects of a present when the blt cost model estimates it is cheaper to copy them together
+    VOID MergePresentRects(
+        _In_ PDO_PRESENT_MEMORY Context,
+        CONST BLT_INFO *pDst,
+        CONST BLT_INFO *pSrc,
+        _Inout_ CONST RECT **ppRects,
+        _Inout_ UINT *pNumRects);
+
+    // Turns the rects of a present into a clipped banded region, returns FALSE to copy the rects as they are
+    BOOLEAN SchedulePresent(
+        _In_ PDO_PRESENT_MEMORY Context,
+        CONST BLT_INFO *pSrc,
+        _In_reads_opt_(NumInputRects) CONST RECT *pInputRects,
+        UINT NumInputRects,
+        _Outptr_result_buffer_(*pNumRects) CONST RECT **ppRects,
+        _Out_ UINT *pNumRects);
+    ULONG CountPagesWritten(CONST BLT_INFO *pDst, UINT NumRects, _In_reads_(NumRects) CONST RECT *pRects);
+
+    // Scrolls by moving the visible frame, returns FALSE if the present has no scroll worth panning
+    BOOLEAN PanPresent(_In_ PDO_PRESENT_MEMORY Context, CONST BLT_INFO *pDst, CONST BLT_INFO *pSrc);
+    VOID ScrollChangeDetection(CONST BLT_INFO *pSrc, _In_ CONST RECT *pScrolled, LONG Dy, BOOLEAN Rebased);
+
+    // Draws a present into the back frame and flips it to the front, returns the number of pixels written
+    LONGLONG FlipPresent(
+        _In_ PDO_PRESENT_MEMORY Context,
+        CONST BLT_INFO *pDst,
+        CONST BLT_INFO *pSrc,
+        _In_reads_opt_(NumRects) CONST RECT *pRects,
+        UINT NumRects);
+
+    NTSTATUS ReserveRects(_Inout_ BDD_PRESENT_ENTRY *pEntry, ULONG NumMoves, ULONG NumDirtyRects);
+
+    // Sets SrcAddr of the present to a system space mapping of the source surface
+    NTSTATUS AcquirePresentSource(_Inout_ PDO_PRESENT_MEMORY Context, _In_ BYTE *SrcAddr, SIZE_T Size);
+    VOID ReleasePresentSource(_Inout_ PDO_PRESENT_MEMORY Context);
+    VOID UnlockSourceMapping(_Inout_ BDD_SOURCE_MAPPING *pMapping);
+    VOID ReleaseDarkPresent();
+
+    static VOID ProcessNotify(_In_ HANDLE ParentId, _In_ HANDLE ProcessId, _In_ BOOLEAN Create);
+
+    // Used by presents executed synchronously
+    DO_PRESENT_MEMORY m_PresentContext;
+
+    // Presents are executed in order by the worker thread and completed with DxgkCbPresentDisplayOnlyProgress. The
+    // semaphores count the queued and free entries of the ring, the head is only used by the worker and the tail only
+    // by PresentDisplayOnly. WaitForPresents drains the ring holding m_DrainLock, as two drainers each owning part of
+    // the free entries would wait on each other forever.
+    PKTHREAD m_pPresentWorkerThread;
+    KEVENT m_StopWorkerEvent;
+    KSEMAPHORE m_QueuedPresents;
+    KSEMAPHORE m_FreePresentEntries;
+    KGUARDED_MUTEX m_DrainLock;
+    BDD_PRESENT_ENTRY m_PresentQueue[BDD_PRESENT_QUEUE_DEPTH];
+    ULONG m_QueueHead;
+    ULONG m_QueueTail;
+
+    // Pacing: the tick event is set by the VSync timer, and the presents queued by a tick are executed as a single
+    // present of the newest source with the rects of all of them
+    BOOLEAN m_Paced;
+    KEVENT m_PresentTickEvent;
+    DO_PRESENT_MEMORY m_CoalescedPresent;
+    RECT *m_pCoalescedRects;
+    UINT m_CoalescedCapacity;
+
+    // Deferred I/O: the back buffer holds the unrotated source as of the last present. m_FlushLock is held while the
+    // back buffer is flushed or replaced, m_DeferredLock protects the damage and the destination of the next flush.
+    ULONG m_FlushInterval; // Milliseconds between flushes, 0 if presents are not deferred
+    BYTE *m_pBackBuffer;
+    SIZE_T m_BackBufferSize;
+    KGUARDED_MUTEX m_FlushLock;
+    KGUARDED_MUTEX m_DeferredLock;
+    BDD_REGION m_DeferredDamage;
+    BOOLEAN m_DeferredOverflow; // The damage could not be grown, the whole source is flushed
+    BYTE *m_DeferredDstAddr;
+    UINT m_DeferredDstBitPerPixel;
+    D3DKMDT_VIDPN_PRESENT_PATH_ROTATION m_DeferredRotation;
+    DO_PRESENT_MEMORY m_FlushPresent;
+    RECT *m_pFlushRects;
+    UINT m_FlushCapacity;
+
+    // Dark presents: the damage since the source went dark, in the unrotated source, and the latest source surface,
+    // whose mapping m_DarkPresent holds while m_DarkPending is set. m_DarkOverflow is also set when the frame buffer
+    // was written outside of presents, so the catch up copies the whole source. m_DarkLock is held while the dark
+    // source is used, as ProcessNotify unlocks it when the process presenting it exits.
+    KGUARDED_MUTEX m_DarkLock;
+    DO_PRESENT_MEMORY m_DarkPresent;
+    PEPROCESS m_DarkProcess;
+    BDD_REGION m_DarkDamage;
+    BOOLEAN m_DarkOverflow;
+    BOOLEAN m_DarkPending;
+
+    // Write budget token bucket, in bytes of damage: refilled at m_WriteBudget bytes per second up to one burst, and
+    // charged for the damage of the presents it lets through, down to one burst below zero for a present larger than
+    // a burst. The drain event is set while WaitForPresents waits for the queue, the presents then skip the budget.
+    ULONG m_WriteBudget;
+    LONGLONG m_BudgetTokens;
+    LONGLONG m_BudgetBurst;
+    LARGE_INTEGER m_BudgetRefillTime;
+    BDD_REGION m_QueuedDamage;
+    KEVENT m_DrainPresentsEvent;
+
+    // Protected by m_SourceCacheLock, presents may come from several processes
+    KGUARDED_MUTEX m_SourceCacheLock;
+    BDD_SOURCE_MAPPING m_SourceCache[BDD_SOURCE_CACHE_SIZE];
+    ULONG64 m_SourceCacheClock;
+
+    // Source whose locking failure was logged, NULL once a source is locked again. A source that cannot be locked
+    // fails on every present, so only the first failure is logged.
+    PVOID m_LockFailedSource;
+
+    // Link in the list of sources walked by ProcessNotify, which holds the rundown while it waits on the source
+    LIST_ENTRY m_SourceLink;
+    EX_RUNDOWN_REF m_NotifyRundown;
+
+    // Change detection state, only used by the thread executing presents
+    BDD_CHANGE_DETECTION m_ChangeDetection;
+    BYTE *m_pShadow;
+    SIZE_T m_ShadowSize;
+    ULONG64 *m_pTileHashes;           // Row-major hashes of the tiles of the unrotated source, 0 if unknown
+    BDD_TILE_POLICY *m_pTilePolicies; // Row-major policies of the tiles of the unrotated source
+    UINT m_NumTiles;
+    BOOLEAN m_ChangeDetectionValid;
+    D3DKMDT_VIDPN_PRESENT_PATH_ROTATION m_ChangeDetectionRotation;
+    RECT *m_pDamage;
+    UINT m_DamageCapacity;
+
+    // Measured costs of the adaptive policy, in picoseconds per KiB of the source: copying to the frame buffer, and
+    // comparing against the shadow. A flush is write bound when it took over half the flush interval, then tiles it
+    // writes every time may be left to the next flush, unless the flush drains the damage.
+    LONGLONG m_CopyCost;
+    LONGLONG m_CompareCost;
+    LONGLONG m_PicosecondsPerTick;
+    ULONG m_FlushSequence;
+    BOOLEAN m_FlushWriteBound;
+    BOOLEAN m_FlushMayDefer; // The current flush may leave tiles to the next one
+
+    RECT *m_pMergedRects;
+    UINT m_MergeCapacity;
+    BDD_REGION m_PresentRegion;
+
+    // Double buffering: the frame presents are copied to, whether each frame must be copied whole, and the damage of
+    // the last flip, which the back frame still lacks
+    UINT m_BackFrame;
+    BOOLEAN m_FrameStale[2];
+    BDD_REGION m_FlipDamage;
+
+    // Scroll panning: the row of the frame buffer the visible frame starts at
+    UINT m_PanRow;
+
+    BDD_PRESENT_STATS m_Stats;
 };
 
 class BASIC_DISPLAY_DRIVER {
@@ -165,6 +576,10 @@ private:
 
     PVOID m_MappedBar2;
 
+    // Held over every sequence of DISPI register accesses, as the present worker pans and flips the frame buffer
+    // while the DDIs set and restore modes
+    KSPIN_LOCK m_DispiLock;
+
     // Array of EDIDs, currently only supporting base block, hence EDID_V1_BLOCK_SIZE for size of each EDID
     BYTE m_EDIDs[MAX_CHILDREN][EDID_V1_BLOCK_SIZE];
 
@@ -189,6 +604,45 @@ private:
 
     BDD_VBE_INFO m_VbeInfo;
 
+    // Change detection selected for presents by the registry
+    BDD_CHANGE_DETECTION m_ChangeDetection;
+
+    // Double buffering requested by the registry, used by the modes that fit twice in video memory
+    BOOLEAN m_DoubleBuffer;
+
+    // Scroll panning requested by the registry, used by the modes with spare video memory rows when not double
+    // buffered
+    BOOLEAN m_ScrollPanning;
+
+    // Presents per second of each source set by the registry, 0 if presents are executed as they come
+    ULONG m_PresentRate;
+
+    // Bytes of damage per second each source may write set by the registry, 0 if unlimited
+    ULONG m_WriteBudget;
+
+    // Milliseconds between the flushes of deferred I/O set by the registry, 0 if presents write the frame buffer
+    ULONG m_DeferredFlushInterval;
+
+    // The VSync timer runs while presents are paced or the OS enabled the display-only VSync interrupt
+    PEX_TIMER m_pVSyncTimer;
+    BOOLEAN m_VSyncTimerSet;
+    BOOLEAN m_VSyncInterrupt;
+
+    // Fast resume requested by the registry: the DISPI registers, the mode of source 0 and its visible frame are saved
+    // when the adapter enters D3, and restored as soon as it returns to D0
+    BOOLEAN m_FastResume;
+    BOOLEAN m_ResumePending;
+    USHORT m_ResumeDispi[VBE_DISPI_INDEX_Y_OFFSET + 1];
+    CURRENT_BDD_MODE m_ResumeMode;
+    BYTE *m_pResumeFrame;
+    SIZE_T m_ResumeFrameSize;
+
+    // Seamless boot requested by the registry: starting the device leaves DISPI enabled, and the first commit of the
+    // mode it already shows neither sets the mode again nor clears the frame. The pending flag is set by a start that
+    // kept the firmware mode and cleared by the first commit.
+    BOOLEAN m_SeamlessBoot;
+    BOOLEAN m_SeamlessAdoptPending;
+
 public:
     BASIC_DISPLAY_DRIVER(_In_ DEVICE_OBJECT *pPhysicalDeviceObject);
     ~BASIC_DISPLAY_DRIVER();
@@ -218,6 +672,13 @@ public:
         return &m_DxgkInterface;
     }
 
+    NTSTATUS ControlInterrupt(_In_ CONST DXGK_INTERRUPT_TYPE InterruptType, _In_ BOOLEAN EnableInterrupt);
+
+    // Scans out the given frame of a double buffered source
+    VOID FlipFrameBuffer(D3DDDI_VIDEO_PRESENT_SOURCE_ID SourceId, UINT Frame);
+    // Scans out the frame starting at the given row of a scroll panned source
+    VOID PanFrameBuffer(D3DDDI_VIDEO_PRESENT_SOURCE_ID SourceId, UINT Row);
+
     // Not implemented since no IOCTLs currently handled.
     NTSTATUS DispatchIoRequest(_In_ ULONG VidPnSourceId, _In_ VIDEO_REQUEST_PACKET *pVideoRequestPacket);
 
@@ -337,6 +798,12 @@ private:
 
     VOID BlackOutScreen(D3DDDI_VIDEO_PRESENT_SOURCE_ID SourceId);
 
+    // Returns where presents of the source start in its frame buffer mapping, centered when the mode is
+    BYTE *GetPresentDst(D3DDDI_VIDEO_PRESENT_SOURCE_ID SourceId, _Out_ UINT *pDstBitPerPixel) const;
+
+    // Copies what changed while the source was dark, once it is visible and its monitor is on
+    VOID CatchUpDarkPresents(D3DDDI_VIDEO_PRESENT_SOURCE_ID SourceId);
+
     // Returns the index into gBddBiosData.BddModes of the VBE mode that matches the given VidPnSourceMode.
     // If such a mode cannot be found, returns a number outside of [0, gBddBiosData.CountBddModes)
     UINT FindMatchingVBEMode(CONST D3DKMDT_VIDPN_SOURCE_MODE *pSourceMode) const;
@@ -369,8 +836,32 @@ private:
     NTSTATUS StartHardware();
     NTSTATUS StopHardware();
 
+    // Selects the fastest Blt kernels for this processor and framebuffer, using offscreen video memory
+    VOID CalibrateBlt();
+
+    // Waits for the queued presents of all the sources, before the frame buffer they target changes
+    VOID WaitForPresents();
+
+    // Drops the cached source mappings of all the sources, their surfaces are reallocated on mode and power changes
+    VOID InvalidateSourceCaches();
+
     NTSTATUS FindMemoryResource(_In_ ULONG Index, _Out_opt_ PULONGLONG Start, _Out_ PULONGLONG Size);
 
+    // Reads the optional settings of the device from its driver registry key
+    VOID ReadConfiguration();
+
+    // Saves the state restored by FastResume when the adapter enters D3
+    VOID SaveResumeState();
+
+    // Restores the mode and frame of source 0 saved by SaveResumeState, returns FALSE if they must wait for Windows to
+    // commit its VidPn again
+    BOOLEAN FastResume();
+
+    // Starts or stops the VSync timer depending on whether presents are paced or the VSync interrupt is enabled
+    VOID UpdateVSyncTimer();
+    static EXT_CALLBACK VSyncTimerCallback;
+    static KSYNCHRONIZE_ROUTINE NotifyVSync;
+
     // Helper function for RegisterHWInfo
     NTSTATUS WriteHWInfoStr(_In_ HANDLE DevInstRegKeyHandle, _In_ PCWSTR pszwValueName, _In_ PCSTR pszValue);
 
@@ -397,16 +888,86 @@ private:
     NTSTATUS
     AddVBEMode(USHORT Width, USHORT Height, USHORT Bpp, _In_opt_ CONST PHYSICAL_ADDRESS *PhysicalAddress = NULL);
     NTSTATUS EnumerateVBE(_In_opt_ PDXGK_DISPLAY_INFORMATION PostDisplayInfo);
-    NTSTATUS SetVBEMode(USHORT ModeNumber);
+    NTSTATUS SetVBEMode(USHORT ModeNumber, USHORT VirtualHeight);
+    NTSTATUS SetVBEVirtualHeight(USHORT ModeNumber, USHORT VirtualHeight);
+
+    // Writes the virtual height with m_DispiLock held, returns FALSE if the device clamped it
+    BOOLEAN WriteVBEVirtualHeight(USHORT ModeNumber, USHORT VirtualHeight);
+
+    // Reads the capabilities of DISPI into m_VbeInfo, keeping the mode on screen if KeepMode is set or disabling DISPI
+    // otherwise. Returns FALSE if the device does not report them.
+    BOOLEAN ReadVBECaps(BOOLEAN KeepMode);
+
+    // TRUE if DISPI already shows the mode from the start of video memory, as left by the firmware
+    BOOLEAN IsVBEModeSet(USHORT ModeNumber);
+
+    // Reads the mode registers of DISPI, up to VBE_DISPI_INDEX_Y_OFFSET, and writes them back
+    VOID SaveVBEState(_Out_writes_(VBE_DISPI_INDEX_Y_OFFSET + 1) USHORT *pRegisters);
+    NTSTATUS RestoreVBEState(_In_reads_(VBE_DISPI_INDEX_Y_OFFSET + 1) CONST USHORT *pRegisters);
 };
 
 //
 // Blt functions
 //
 
+// Detects the processor features used by the Blt functions, selects default kernels and starts the band threads
+VOID BltInitialize(VOID);
+
+// Stops the threads started by BltInitialize, called when the driver unloads
+VOID BltUninitialize(VOID);
+
+// Estimated cost of copying rects to the frame buffer, measured by BltCalibrate
+typedef struct _BLT_COST_MODEL {
+    ULONG RectCost;     // Picoseconds per rect copied
+    ULONG PageCost;     // Picoseconds per distinct frame buffer page written
+    ULONG KiBCost;      // Picoseconds per KiB copied
+    ULONG BandKiBCost;  // Picoseconds per KiB copied of the rects split in bands copied in parallel
+    ULONG BandMinBytes; // Source bytes from which a rect is split in bands, MAXULONG without band threads
+} BLT_COST_MODEL;
+
+VOID BltGetCostModel(_Out_ BLT_COST_MODEL *pModel);
+
+// Size of the offscreen framebuffer area needed by BltCalibrate
+#define BLT_CALIBRATION_SIZE (1024 * 1024)
+
+// Times the Blt kernels against the framebuffer mapping at pScratch, which must not be visible
+VOID BltCalibrate(_Out_writes_bytes_(Size) BYTE *pScratch, SIZE_T Size);
+
 // Must be Non-Paged
 VOID BltBits(BLT_INFO *pDst, CONST BLT_INFO *pSrc, UINT NumRects, _In_reads_(NumRects) CONST RECT *pRects);
 
+// Copies all the move destination rects and dirty rects of a present, must be called at IRQL <= APC_LEVEL. Returns
+// FALSE if not all of them were copied.
+BOOLEAN BltPresentRects(
+    BLT_INFO *pDst,
+    CONST BLT_INFO *pSrc,
+    UINT NumMoves,
+    _In_reads_(NumMoves) CONST D3DKMT_MOVE_RECT *pMoves,
+    UINT NumDirtyRects,
+    _In_reads_(NumDirtyRects) CONST RECT *pDirtyRects);
+
+// Copies the rects of a BDD_REGION in frame buffer order, must be called at IRQL <= APC_LEVEL. Returns FALSE if not all
+// of them were copied.
+BOOLEAN BltPresentBands(BLT_INFO *pDst, CONST BLT_INFO *pSrc, UINT NumRects, _In_reads_(NumRects) CONST RECT *pRects);
+
+// Compares a rect of the source with its shadow copy, returns the changed spans and updates the shadow
+UINT BltDiffRect(
+    CONST BLT_INFO *pSrc,
+    BLT_INFO *pShadow,
+    _In_ CONST RECT *pRect,
+    _Out_writes_to_(MaxSpans, return) RECT *pSpans,
+    UINT MaxSpans);
+
+// Returns a non-zero 64-bit hash of a rect of a 32bpp surface, or zero if it could not be read
+ULONG64 BltHashRect(CONST BLT_INFO *pSrc, _In_ CONST RECT *pRect);
+
+// Must be Non-Paged
+// Must be called once after the last BltBits of a present, to order the non-temporal framebuffer writes
+VOID BltFlush(VOID);
+
+// Zeroes part of the frame buffer without reading it, the writes are ordered on return
+VOID BltZeroFrame(_Out_writes_bytes_(Bytes) BYTE *pDst, SIZE_T Bytes);
+
 //
 // Driver Entry point
 //
@@ -479,6 +1040,13 @@ BddDdiInterruptRoutine(_In_ VOID *pDeviceContext, _In_ ULONG MessageNumber);
 
 VOID BddDdiDpcRoutine(_In_ VOID *pDeviceContext);
 
+NTSTATUS
+APIENTRY
+BddDdiControlInterrupt(
+    _In_ CONST HANDLE hAdapter,
+    _In_ CONST DXGK_INTERRUPT_TYPE InterruptType,
+    _In_ BOOLEAN EnableInterrupt);
+
 //
 // WDDM Display Only Driver DDIs
 //
@@ -30,6 +30,7 @@ extern "C" NTSTATUS DriverEntry(_In_ DRIVER_OBJECT *pDriverObject, _In_ UNICODE_
     InitialData.DxgkDdiDispatchIoRequest = BddDdiDispatchIoRequest;
     InitialData.DxgkDdiInterruptRoutine = BddDdiInterruptRoutine;
     InitialData.DxgkDdiDpcRoutine = BddDdiDpcRoutine;
+    InitialData.DxgkDdiControlInterrupt = BddDdiControlInterrupt;
     InitialData.DxgkDdiQueryChildRelations = BddDdiQueryChildRelations;
     InitialData.DxgkDdiQueryChildStatus = BddDdiQueryChildStatus;
     InitialData.DxgkDdiQueryDeviceDescriptor = BddDdiQueryDeviceDescriptor;
@@ -51,9 +52,12 @@ extern "C" NTSTATUS DriverEntry(_In_ DRIVER_OBJECT *pDriverObject, _In_ UNICODE_
     InitialData.DxgkDdiSystemDisplayEnable = BddDdiSystemDisplayEnable;
     InitialData.DxgkDdiSystemDisplayWrite = BddDdiSystemDisplayWrite;
 
+    BDD_HWBLT::RegisterProcessNotify();
+
     NTSTATUS Status = DxgkInitializeDisplayOnlyDriver(pDriverObject, pRegistryPath, &InitialData);
     if (!NT_SUCCESS(Status)) {
         BDD_LOG_ERROR("DxgkInitializeDisplayOnlyDriver failed with Status: 0x%x", Status);
+        BDD_HWBLT::UnregisterProcessNotify();
         return Status;
     }
 
@@ -71,6 +75,9 @@ extern "C" NTSTATUS DriverEntry(_In_ DRIVER_OBJECT *pDriverObject, _In_ UNICODE_
 
 VOID BddDdiUnload(VOID) {
     PAGED_CODE();
+
+    BltUninitialize();
+    BDD_HWBLT::UnregisterProcessNotify();
 }
 
 NTSTATUS
@@ -443,6 +450,22 @@ VOID BddDdiDpcRoutine(_In_ VOID *pDeviceContext) {
     pBDD->DpcRoutine();
 }
 
+NTSTATUS
+APIENTRY
+BddDdiControlInterrupt(
+    _In_ CONST HANDLE hAdapter,
+    _In_ CONST DXGK_INTERRUPT_TYPE InterruptType,
+    _In_ BOOLEAN EnableInterrupt) {
+    BDD_ASSERT_CHK(hAdapter != NULL);
+
+    BASIC_DISPLAY_DRIVER *pBDD = reinterpret_cast<BASIC_DISPLAY_DRIVER *>(hAdapter);
+    if (!pBDD->IsDriverActive()) {
+        BDD_LOG_ASSERTION("BDD (0x%p) is being called when not active!", pBDD);
+        return STATUS_UNSUCCESSFUL;
+    }
+    return pBDD->ControlInterrupt(InterruptType, EnableInterrupt);
+}
+
 BOOLEAN
 BddDdiInterruptRoutine(_In_ VOID *pDeviceContext, _In_ ULONG MessageNumber) {
     BDD_ASSERT_CHK(pDeviceContext != NULL);
@@ -551,6 +551,8 @@ BASIC_DISPLAY_DRIVER::SetVidPnSourceVisibility(_In_ CONST DXGKARG_SETVIDPNSOURCE
         ? MAX_VIEWS
         : pSetVidPnSourceVisibility->VidPnSourceId + 1;
 
+    WaitForPresents();
+
     for (UINT SourceId = StartVidPnSourceId; SourceId < MaxVidPnSourceId; ++SourceId) {
         if (pSetVidPnSourceVisibility->Visible) {
             m_CurrentModes[SourceId].Flags.FullscreenPresent = TRUE;
@@ -560,6 +562,10 @@ BASIC_DISPLAY_DRIVER::SetVidPnSourceVisibility(_In_ CONST DXGKARG_SETVIDPNSOURCE
 
         // Store current visibility so it can be dealt with during Present call
         m_CurrentModes[SourceId].Flags.SourceNotVisible = !(pSetVidPnSourceVisibility->Visible);
+
+        if (pSetVidPnSourceVisibility->Visible) {
+            CatchUpDarkPresents(SourceId);
+        }
     }
 
     return STATUS_SUCCESS;
@@ -584,6 +590,15 @@ NTSTATUS BASIC_DISPLAY_DRIVER::CommitVidPn(_In_ CONST DXGKARG_COMMITVIDPN *CONST
     CONST D3DKMDT_VIDPN_PRESENT_PATH *pVidPnPresentPath = NULL;
     CONST D3DKMDT_VIDPN_SOURCE_MODE *pPinnedVidPnSourceModeInfo = NULL;
     SIZE_T NumPathsFromSource;
+    LARGE_INTEGER Frequency;
+    LARGE_INTEGER End;
+
+    // Mode switches are timed from here to the blacked out screen
+    LARGE_INTEGER Start = KeQueryPerformanceCounter(NULL);
+
+    // The frame buffer may be remapped below, and DWM reallocates its surfaces on mode changes
+    WaitForPresents();
+    InvalidateSourceCaches();
 
     // Check this CommitVidPn is for the mode change notification when monitor is in power off state.
     if (pCommitVidPn->Flags.PathPoweredOff) {
@@ -658,8 +673,7 @@ NTSTATUS BASIC_DISPLAY_DRIVER::CommitVidPn(_In_ CONST DXGKARG_COMMITVIDPN *CONST
         !m_CurrentModes[pCommitVidPn->AffectedVidPnSourceId].Flags.DoNotMapOrUnmap) {
         Status = UnmapFrameBuffer(
             m_CurrentModes[pCommitVidPn->AffectedVidPnSourceId].FrameBuffer.Ptr,
-            m_CurrentModes[pCommitVidPn->AffectedVidPnSourceId].DispInfo.Pitch *
-                m_CurrentModes[pCommitVidPn->AffectedVidPnSourceId].DispInfo.Height);
+            GetFrameBufferMappingSize(&m_CurrentModes[pCommitVidPn->AffectedVidPnSourceId]));
         m_CurrentModes[pCommitVidPn->AffectedVidPnSourceId].FrameBuffer.Ptr = NULL;
         m_CurrentModes[pCommitVidPn->AffectedVidPnSourceId].Flags.FrameBufferIsActive = FALSE;
 
@@ -668,6 +682,9 @@ NTSTATUS BASIC_DISPLAY_DRIVER::CommitVidPn(_In_ CONST DXGKARG_COMMITVIDPN *CONST
         }
     }
 
+    m_HardwareBlt[pCommitVidPn->AffectedVidPnSourceId].FreeChangeDetection();
+    m_HardwareBlt[pCommitVidPn->AffectedVidPnSourceId].DiscardDarkPresents(NULL);
+
     if (pPinnedVidPnSourceModeInfo == NULL) {
         // There is no mode to pin on this source, any old paths here have already been cleared
         Status = STATUS_SUCCESS;
@@ -752,6 +769,14 @@ NTSTATUS BASIC_DISPLAY_DRIVER::CommitVidPn(_In_ CONST DXGKARG_COMMITVIDPN *CONST
         pVidPnPresentPath = NULL; // Successfully released it
     }
 
+    End = KeQueryPerformanceCounter(&Frequency);
+    BDD_LOG_INFO(
+        "Switched source %u to %ux%u in %I64d us",
+        pCommitVidPn->AffectedVidPnSourceId,
+        m_CurrentModes[pCommitVidPn->AffectedVidPnSourceId].DispInfo.Width,
+        m_CurrentModes[pCommitVidPn->AffectedVidPnSourceId].DispInfo.Height,
+        (End.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart);
+
 CommitVidPnExit:
 
     NTSTATUS TempStatus;
@@ -806,11 +831,37 @@ NTSTATUS BASIC_DISPLAY_DRIVER::SetSourceModeAndPath(
     CURRENT_BDD_MODE *pCurrentBddMode = &m_CurrentModes[pPath->VidPnSourceId];
 
     NTSTATUS Status = STATUS_SUCCESS;
+    BOOLEAN Adopted = FALSE;
+    BOOLEAN MayAdopt = m_SeamlessAdoptPending;
+    m_SeamlessAdoptPending = FALSE;
+
+    pCurrentBddMode->Flags.DoubleBuffered = FALSE;
+    pCurrentBddMode->Flags.ScrollPanned = FALSE;
 
     // Try to set VBE mode if it matches
     UINT ModeIndex = FindMatchingVBEMode(pSourceMode);
     if (ModeIndex < m_VbeInfo.ModeCount) {
-        Status = SetVBEMode(m_VbeInfo.Modes[ModeIndex].ModeNumber);
+        // Rows of video memory after the start of the mode, which Y_OFFSET can use beyond the visible height
+        USHORT Height = m_VbeInfo.Modes[ModeIndex].Height;
+        ULONGLONG ModeOffset =
+            m_VbeInfo.Modes[ModeIndex].PhysicalAddress.QuadPart - m_VbeInfo.Framebuffer.QuadPart;
+        ULONGLONG Rows = (m_VbeInfo.VideoMemory - ModeOffset) / m_VbeInfo.Modes[ModeIndex].Pitch;
+        Rows = min(Rows, min((ULONGLONG)Height * BDD_PAN_FRAMES, MAXUSHORT));
+
+        BOOLEAN DoubleBuffer = m_DoubleBuffer && Rows >= (ULONGLONG)Height * 2;
+        BOOLEAN ScrollPanned = !DoubleBuffer && m_ScrollPanning && Rows > Height;
+        USHORT VirtualHeight = DoubleBuffer ? (USHORT)(Height * 2) : (ScrollPanned ? (USHORT)Rows : Height);
+
+        // The mode the firmware left on screen is adopted as it is, only its virtual height may grow
+        USHORT ModeNumber = m_VbeInfo.Modes[ModeIndex].ModeNumber;
+        Adopted = MayAdopt && IsVBEModeSet(ModeNumber);
+        Status = Adopted ? SetVBEVirtualHeight(ModeNumber, VirtualHeight) : SetVBEMode(ModeNumber, VirtualHeight);
+        if (Status == STATUS_NOT_SUPPORTED && VirtualHeight > Height) {
+            DoubleBuffer = FALSE;
+            ScrollPanned = FALSE;
+            VirtualHeight = Height;
+            Status = Adopted ? SetVBEVirtualHeight(ModeNumber, VirtualHeight) : SetVBEMode(ModeNumber, VirtualHeight);
+        }
         if (!NT_SUCCESS(Status)) {
             BDD_LOG_ERROR(
                 "SetVBEMode failed with Status = 0x%x, ModeNumber = 0x%hu",
@@ -824,6 +875,9 @@ NTSTATUS BASIC_DISPLAY_DRIVER::SetSourceModeAndPath(
         pCurrentBddMode->DispInfo.Pitch = m_VbeInfo.Modes[ModeIndex].Pitch;
         pCurrentBddMode->DispInfo.ColorFormat = PixelFormatFromBPP(m_VbeInfo.Modes[ModeIndex].BitsPerPixel);
         pCurrentBddMode->DispInfo.PhysicAddress = m_VbeInfo.Modes[ModeIndex].PhysicalAddress;
+        pCurrentBddMode->VirtualHeight = VirtualHeight;
+        pCurrentBddMode->Flags.DoubleBuffered = DoubleBuffer;
+        pCurrentBddMode->Flags.ScrollPanned = ScrollPanned;
     }
 
     pCurrentBddMode->Scaling = pPath->ContentTransformation.Scaling;
@@ -836,14 +890,28 @@ NTSTATUS BASIC_DISPLAY_DRIVER::SetSourceModeAndPath(
         BDD_ASSERT(pCurrentBddMode->FrameBuffer.Ptr == NULL);
         Status = MapFrameBuffer(
             pCurrentBddMode->DispInfo.PhysicAddress,
-            pCurrentBddMode->DispInfo.Pitch * pCurrentBddMode->DispInfo.Height,
+            GetFrameBufferMappingSize(pCurrentBddMode),
             &(pCurrentBddMode->FrameBuffer.Ptr));
     }
 
     if (NT_SUCCESS(Status)) {
 
         pCurrentBddMode->Flags.FrameBufferIsActive = TRUE;
-        BlackOutScreen(pPath->VidPnSourceId);
+        m_HardwareBlt[pPath->VidPnSourceId].AllocateBackBuffer(pCurrentBddMode);
+        m_HardwareBlt[pPath->VidPnSourceId].AllocateChangeDetection(m_ChangeDetection, pCurrentBddMode);
+        if (Adopted) {
+            // The firmware frame stays on screen until the first present replaces it
+            m_HardwareBlt[pPath->VidPnSourceId].ResetChangeDetection(FALSE);
+            m_HardwareBlt[pPath->VidPnSourceId].ResetFlip();
+            pCurrentBddMode->ZeroedOutStart.QuadPart = 0;
+            pCurrentBddMode->ZeroedOutEnd.QuadPart = 0;
+            BDD_LOG_INFO(
+                "Adopted mode %ux%u without a mode set",
+                pCurrentBddMode->DispInfo.Width,
+                pCurrentBddMode->DispInfo.Height);
+        } else {
+            BlackOutScreen(pPath->VidPnSourceId);
+        }
 
         // Mark that the next present should be fullscreen so the screen doesn't go from black to actual pixels one
         // dirty rect at a time.
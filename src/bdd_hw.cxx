@@ -96,12 +96,8 @@ NTSTATUS BASIC_DISPLAY_DRIVER::StartHardware() {
         m_VbeInfo.VideoMemory = DispiMemory;
     }
 
-    DispiWriteUShort(VBE_DISPI_INDEX_ENABLE, VBE_DISPI_DISABLED | VBE_DISPI_GETCAPS);
-    if (DispiReadUShort(VBE_DISPI_INDEX_ENABLE) == (VBE_DISPI_DISABLED | VBE_DISPI_GETCAPS)) {
-        m_VbeInfo.MaxXres = DispiReadUShort(VBE_DISPI_INDEX_XRES);
-        m_VbeInfo.MaxYres = DispiReadUShort(VBE_DISPI_INDEX_YRES);
-        m_VbeInfo.MaxBpp = DispiReadUShort(VBE_DISPI_INDEX_BPP);
-
+    // For seamless boot, the mode set by the firmware stays on screen while the capabilities are read
+    if (ReadVBECaps(m_SeamlessBoot)) {
         if (m_VbeInfo.MaxXres < 640 || m_VbeInfo.MaxYres < 480 || m_VbeInfo.MaxBpp < BPP) {
             BDD_LOG_ERROR(
                 "DISPI reported capability %hux%hux%hu is not supported (unresponsive device?)",
@@ -116,12 +112,14 @@ NTSTATUS BASIC_DISPLAY_DRIVER::StartHardware() {
                 m_VbeInfo.MaxXres,
                 m_VbeInfo.MaxYres,
                 m_VbeInfo.MaxBpp);
+
+            // Only the first commit may adopt the firmware mode, later ones set the mode they commit
+            m_SeamlessAdoptPending = m_SeamlessBoot;
         }
     } else {
         m_VbeInfo.MaxXres = m_VbeInfo.MaxYres = USHORT_MAX;
         m_VbeInfo.MaxBpp = BPP;
     }
-    DispiWriteUShort(VBE_DISPI_INDEX_ENABLE, VBE_DISPI_DISABLED);
 
     return STATUS_SUCCESS;
 
@@ -191,3 +189,31 @@ BASIC_DISPLAY_DRIVER::FindMemoryResource(_In_ ULONG Index, _Out_opt_ PULONGLONG
 
     return STATUS_SUCCESS;
 }
+
+VOID BASIC_DISPLAY_DRIVER::CalibrateBlt() {
+    PAGED_CODE();
+
+    // Calibrate at the end of VRAM, away from the firmware framebuffer which may still be on screen
+    ULONGLONG VisibleBytes = 0;
+    if (m_Flags.HasPostDisplay) {
+        VisibleBytes = (ULONGLONG)m_CurrentModes[0].DispInfo.Pitch * m_CurrentModes[0].DispInfo.Height;
+    }
+    if (m_VbeInfo.VideoMemory < BLT_CALIBRATION_SIZE || m_VbeInfo.VideoMemory - BLT_CALIBRATION_SIZE < VisibleBytes) {
+        BDD_LOG_INFO("Not enough offscreen video memory for blt calibration, using default kernels");
+        return;
+    }
+
+    PHYSICAL_ADDRESS Scratch;
+    Scratch.QuadPart = m_VbeInfo.Framebuffer.QuadPart + m_VbeInfo.VideoMemory - BLT_CALIBRATION_SIZE;
+
+    VOID *pScratch;
+    NTSTATUS Status = MapFrameBuffer(Scratch, BLT_CALIBRATION_SIZE, &pScratch);
+    if (!NT_SUCCESS(Status)) {
+        BDD_LOG_WARNING("Mapping the blt calibration area failed with status 0x%x", Status);
+        return;
+    }
+
+    BltCalibrate(static_cast<BYTE *>(pScratch), BLT_CALIBRATION_SIZE);
+
+    UnmapFrameBuffer(pScratch, BLT_CALIBRATION_SIZE);
+}
@@ -0,0 +1,324 @@
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "bdd.hxx"
+
+#pragma code_seg("PAGE")
+
+// Smallest rect buffer allocated by a region
+#define BDD_REGION_MIN_RECTS 64
+
+// Returns the index following the last rect of the band starting at First
+static UINT BandEnd(_In_reads_(NumRects) CONST RECT *pRects, UINT NumRects, UINT First) {
+    UINT i = First + 1;
+    while (i < NumRects && pRects[i].top == pRects[First].top) {
+        i++;
+    }
+    return i;
+}
+
+static BOOLEAN IsRectEmpty(_In_ CONST RECT *pRect) {
+    return pRect->left >= pRect->right || pRect->top >= pRect->bottom;
+}
+
+BDD_REGION::BDD_REGION()
+    : m_pRects(NULL),      //
+      m_NumRects(0),       //
+      m_Capacity(0),       //
+      m_pResult(NULL),     //
+      m_NumResult(0),      //
+      m_ResultCapacity(0), //
+      m_LastBand(0),       //
+      m_pAllocations(NULL) {
+    PAGED_CODE();
+}
+
+BDD_REGION::~BDD_REGION() {
+    PAGED_CODE();
+
+    delete[] m_pRects;
+    delete[] m_pResult;
+}
+
+NTSTATUS BDD_REGION::SetRect(_In_ CONST RECT *pRect) {
+    PAGED_CODE();
+
+    SetEmpty();
+    return UnionRect(pRect);
+}
+
+NTSTATUS BDD_REGION::Union(_In_ CONST BDD_REGION *pOther) {
+    PAGED_CODE();
+
+    return Combine(pOther->m_pRects, pOther->m_NumRects, OPERATION_UNION);
+}
+
+NTSTATUS BDD_REGION::UnionRect(_In_ CONST RECT *pRect) {
+    PAGED_CODE();
+
+    if (IsRectEmpty(pRect)) {
+        return STATUS_SUCCESS;
+    }
+    return Combine(pRect, 1, OPERATION_UNION);
+}
+
+NTSTATUS BDD_REGION::Subtract(_In_ CONST BDD_REGION *pOther) {
+    PAGED_CODE();
+
+    return Combine(pOther->m_pRects, pOther->m_NumRects, OPERATION_SUBTRACT);
+}
+
+NTSTATUS BDD_REGION::SubtractRect(_In_ CONST RECT *pRect) {
+    PAGED_CODE();
+
+    if (IsRectEmpty(pRect)) {
+        return STATUS_SUCCESS;
+    }
+    return Combine(pRect, 1, OPERATION_SUBTRACT);
+}
+
+NTSTATUS BDD_REGION::Intersect(_In_ CONST BDD_REGION *pOther) {
+    PAGED_CODE();
+
+    return Combine(pOther->m_pRects, pOther->m_NumRects, OPERATION_INTERSECT);
+}
+
+NTSTATUS BDD_REGION::IntersectRect(_In_ CONST RECT *pRect) {
+    PAGED_CODE();
+
+    if (IsRectEmpty(pRect)) {
+        SetEmpty();
+        return STATUS_SUCCESS;
+    }
+    return Combine(pRect, 1, OPERATION_INTERSECT);
+}
+
+VOID BDD_REGION::Swap(_Inout_ BDD_REGION *pOther) {
+    PAGED_CODE();
+
+    RECT *pRects = m_pRects;
+    UINT NumRects = m_NumRects;
+    UINT Capacity = m_Capacity;
+    m_pRects = pOther->m_pRects;
+    m_NumRects = pOther->m_NumRects;
+    m_Capacity = pOther->m_Capacity;
+    pOther->m_pRects = pRects;
+    pOther->m_NumRects = NumRects;
+    pOther->m_Capacity = Capacity;
+}
+
+NTSTATUS BDD_REGION::ReserveResult(UINT Capacity) {
+    PAGED_CODE();
+
+    if (Capacity <= m_ResultCapacity) {
+        return STATUS_SUCCESS;
+    }
+
+    Capacity = max(Capacity, max(m_ResultCapacity * 2, BDD_REGION_MIN_RECTS));
+    RECT *pResult = new (PagedPool) RECT[Capacity];
+    if (!pResult) {
+        return STATUS_NO_MEMORY;
+    }
+
+    if (m_NumResult != 0) {
+        RtlCopyMemory(pResult, m_pResult, m_NumResult * sizeof(RECT));
+    }
+    delete[] m_pResult;
+    m_pResult = pResult;
+    m_ResultCapacity = Capacity;
+    if (m_pAllocations != NULL) {
+        (*m_pAllocations)++;
+    }
+    return STATUS_SUCCESS;
+}
+
+BOOLEAN BDD_REGION::AppendBand(
+    LONG Top,
+    LONG Bottom,
+    _In_reads_(NumA) CONST RECT *pA,
+    UINT NumA,
+    _In_reads_(NumB) CONST RECT *pB,
+    UINT NumB,
+    OPERATION Operation)
+/*++
+
+  Routine Description:
+
+    The method combines the columns of two bands covering the rows
+    [Top, Bottom), appends the result to m_pResult, and joins it with the
+    band above when they have the same columns
+
+  Arguments:
+
+    Top - first row of the band
+    Bottom - row following the band
+    pA - columns of the region, sorted and disjoint
+    NumA - number of columns of the region
+    pB - columns of the other operand, sorted and disjoint
+    NumB - number of columns of the other operand
+    Operation - how the columns are combined
+
+  Return Value:
+
+    FALSE if the result could not be grown
+
+--*/
+{
+    PAGED_CODE();
+
+    // A band cannot have more columns than its two operands together
+    if (!NT_SUCCESS(ReserveResult(m_NumResult + NumA + NumB))) {
+        return FALSE;
+    }
+
+    UINT First = m_NumResult;
+    UINT a = 0;
+    UINT b = 0;
+    BOOLEAN InA = FALSE;
+    BOOLEAN InB = FALSE;
+    BOOLEAN Inside = FALSE;
+    LONG Start = 0;
+    while (a < NumA || b < NumB) {
+        LONG NextA = (a < NumA) ? (InA ? pA[a].right : pA[a].left) : MAXLONG;
+        LONG NextB = (b < NumB) ? (InB ? pB[b].right : pB[b].left) : MAXLONG;
+        LONG x = min(NextA, NextB);
+
+        if (NextA == x) {
+            InA = !InA;
+            a += InA ? 0 : 1;
+        }
+        if (NextB == x) {
+            InB = !InB;
+            b += InB ? 0 : 1;
+        }
+
+        BOOLEAN WasInside = Inside;
+        switch (Operation) {
+        case OPERATION_UNION:
+            Inside = InA || InB;
+            break;
+        case OPERATION_SUBTRACT:
+            Inside = InA && !InB;
+            break;
+        default:
+            Inside = InA && InB;
+            break;
+        }
+
+        if (!WasInside && Inside) {
+            Start = x;
+        } else if (WasInside && !Inside) {
+            if (m_NumResult != First && m_pResult[m_NumResult - 1].right == Start) {
+                m_pResult[m_NumResult - 1].right = x;
+            } else {
+                m_pResult[m_NumResult].left = Start;
+                m_pResult[m_NumResult].top = Top;
+                m_pResult[m_NumResult].right = x;
+                m_pResult[m_NumResult].bottom = Bottom;
+                m_NumResult++;
+            }
+        }
+    }
+
+    UINT NumColumns = m_NumResult - First;
+    if (NumColumns == 0) {
+        return TRUE;
+    }
+
+    BOOLEAN SameColumns = First != 0 && m_pResult[m_LastBand].bottom == Top && First - m_LastBand == NumColumns;
+    for (UINT i = 0; SameColumns && i < NumColumns; i++) {
+        SameColumns = m_pResult[m_LastBand + i].left == m_pResult[First + i].left &&
+            m_pResult[m_LastBand + i].right == m_pResult[First + i].right;
+    }
+
+    if (SameColumns) {
+        for (UINT i = m_LastBand; i < First; i++) {
+            m_pResult[i].bottom = Bottom;
+        }
+        m_NumResult = First;
+    } else {
+        m_LastBand = First;
+    }
+    return TRUE;
+}
+
+NTSTATUS BDD_REGION::Combine(_In_reads_(NumOther) CONST RECT *pOther, UINT NumOther, OPERATION Operation)
+/*++
+
+  Routine Description:
+
+    The method sweeps the bands of the region and of the other operand from
+    top to bottom, cutting them at every band edge of either operand, and
+    replaces the region with the combination of the two
+
+  Arguments:
+
+    pOther - rects of the other operand, in the order of a region
+    NumOther - number of rects of the other operand
+    Operation - how the operands are combined
+
+  Return Value:
+
+    STATUS_NO_MEMORY if the result could not be allocated, in which case
+    the region is left unchanged
+
+--*/
+{
+    PAGED_CODE();
+
+    m_NumResult = 0;
+    m_LastBand = 0;
+
+    UINT i = 0;
+    UINT j = 0;
+    LONG y = MINLONG;
+    while (i < m_NumRects || j < NumOther) {
+        if (Operation == OPERATION_SUBTRACT && i == m_NumRects) {
+            break;
+        }
+        if (Operation == OPERATION_INTERSECT && (i == m_NumRects || j == NumOther)) {
+            break;
+        }
+
+        UINT EndA = (i < m_NumRects) ? BandEnd(m_pRects, m_NumRects, i) : i;
+        UINT EndB = (j < NumOther) ? BandEnd(pOther, NumOther, j) : j;
+        LONG TopA = (i < m_NumRects) ? max(m_pRects[i].top, y) : MAXLONG;
+        LONG BottomA = (i < m_NumRects) ? m_pRects[i].bottom : MAXLONG;
+        LONG TopB = (j < NumOther) ? max(pOther[j].top, y) : MAXLONG;
+        LONG BottomB = (j < NumOther) ? pOther[j].bottom : MAXLONG;
+
+        // The next band starts at the first remaining row of either operand and ends at the next edge of either
+        LONG Top = min(TopA, TopB);
+        LONG Bottom = min((TopA > Top) ? TopA : BottomA, (TopB > Top) ? TopB : BottomB);
+        BOOLEAN InA = TopA == Top;
+        BOOLEAN InB = TopB == Top;
+
+        if (!AppendBand(
+                Top,
+                Bottom,
+                m_pRects + i,
+                InA ? EndA - i : 0,
+                pOther + j,
+                InB ? EndB - j : 0,
+                Operation)) {
+            return STATUS_NO_MEMORY;
+        }
+
+        y = Bottom;
+        if (BottomA <= y) {
+            i = EndA;
+        }
+        if (BottomB <= y) {
+            j = EndB;
+        }
+    }
+
+    RECT *pRects = m_pRects;
+    UINT Capacity = m_Capacity;
+    m_pRects = m_pResult;
+    m_NumRects = m_NumResult;
+    m_Capacity = m_ResultCapacity;
+    m_pResult = pRects;
+    m_NumResult = 0;
+    m_ResultCapacity = Capacity;
+    return STATUS_SUCCESS;
+}
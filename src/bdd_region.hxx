@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+extern "C" {
+#include <ntddk.h>
+#include <windef.h>
+};
+
+// Set of pixels stored as y-x banded rects: the rects are sorted by top then left, do not overlap or touch within a
+// band, and the rects of a band share their top and bottom. Vertically adjacent bands with the same columns are
+// joined, so a region has a single representation.
+//
+// The rect buffers only grow, a region reused across presents stops allocating once it has seen its largest
+// present. Failed operations return STATUS_NO_MEMORY and leave the region unchanged.
+class BDD_REGION {
+public:
+    BDD_REGION();
+    ~BDD_REGION();
+
+    VOID SetEmpty() {
+        m_NumRects = 0;
+    }
+    BOOLEAN IsEmpty() const {
+        return m_NumRects == 0;
+    }
+    UINT GetNumRects() const {
+        return m_NumRects;
+    }
+    CONST RECT *GetRects() const {
+        return m_pRects;
+    }
+
+    NTSTATUS SetRect(_In_ CONST RECT *pRect);
+
+    NTSTATUS Union(_In_ CONST BDD_REGION *pOther);
+    NTSTATUS UnionRect(_In_ CONST RECT *pRect);
+    NTSTATUS Subtract(_In_ CONST BDD_REGION *pOther);
+    NTSTATUS SubtractRect(_In_ CONST RECT *pRect);
+    NTSTATUS Intersect(_In_ CONST BDD_REGION *pOther);
+    NTSTATUS IntersectRect(_In_ CONST RECT *pRect);
+
+    // Exchanges the rects and buffers of two regions
+    VOID Swap(_Inout_ BDD_REGION *pOther);
+
+    // Counts the rect buffers allocated by the region in *pAllocations
+    VOID SetAllocationCounter(_In_ ULONG64 *pAllocations) {
+        m_pAllocations = pAllocations;
+    }
+
+private:
+    typedef enum _OPERATION {
+        OPERATION_UNION = 0,
+        OPERATION_SUBTRACT = 1,
+        OPERATION_INTERSECT = 2,
+    } OPERATION;
+
+    NTSTATUS Combine(_In_reads_(NumOther) CONST RECT *pOther, UINT NumOther, OPERATION Operation);
+    NTSTATUS ReserveResult(UINT Capacity);
+    BOOLEAN AppendBand(
+        LONG Top,
+        LONG Bottom,
+        _In_reads_(NumA) CONST RECT *pA,
+        UINT NumA,
+        _In_reads_(NumB) CONST RECT *pB,
+        UINT NumB,
+        OPERATION Operation);
+
+    RECT *m_pRects;
+    UINT m_NumRects;
+    UINT m_Capacity;
+
+    // Receives the result of an operation, then swapped with m_pRects
+    RECT *m_pResult;
+    UINT m_NumResult;
+    UINT m_ResultCapacity;
+    UINT m_LastBand; // First rect of the last band of the result
+
+    ULONG64 *m_pAllocations; // NULL if the allocations are not counted
+};
@@ -137,9 +137,64 @@ NTSTATUS BASIC_DISPLAY_DRIVER::EnumerateVBE(_In_opt_ PDXGK_DISPLAY_INFORMATION P
     return STATUS_SUCCESS;
 }
 
-NTSTATUS BASIC_DISPLAY_DRIVER::SetVBEMode(USHORT ModeNumber) {
+BOOLEAN BASIC_DISPLAY_DRIVER::IsVBEModeSet(USHORT ModeNumber) {
     PAGED_CODE();
 
+    if (ModeNumber >= m_VbeInfo.ModeCount) {
+        return FALSE;
+    }
+
+    // DISPI scans out from the start of the frame buffer BAR
+    CONST BDD_VBE_MODE *pMode = &m_VbeInfo.Modes[ModeNumber];
+    if (pMode->PhysicalAddress.QuadPart != m_VbeInfo.Framebuffer.QuadPart) {
+        return FALSE;
+    }
+
+    USHORT Registers[VBE_DISPI_INDEX_Y_OFFSET + 1];
+    SaveVBEState(Registers);
+
+    USHORT Enabled = VBE_DISPI_ENABLED | VBE_DISPI_LFB_ENABLED;
+    return (Registers[VBE_DISPI_INDEX_ENABLE] & Enabled) == Enabled && //
+        Registers[VBE_DISPI_INDEX_BANK] == 0 &&                         //
+        Registers[VBE_DISPI_INDEX_XRES] == pMode->Width &&              //
+        Registers[VBE_DISPI_INDEX_YRES] == pMode->Height &&             //
+        Registers[VBE_DISPI_INDEX_BPP] == pMode->BitsPerPixel &&        //
+        Registers[VBE_DISPI_INDEX_VIRT_WIDTH] == pMode->Width &&        //
+        Registers[VBE_DISPI_INDEX_X_OFFSET] == 0 &&                     //
+        Registers[VBE_DISPI_INDEX_Y_OFFSET] == 0;
+}
+
+//
+// Non-Paged Code
+//
+// The DISPI register sequences run under m_DispiLock, at DISPATCH_LEVEL
+#pragma code_seg(push)
+#pragma code_seg()
+
+BOOLEAN BASIC_DISPLAY_DRIVER::ReadVBECaps(BOOLEAN KeepMode) {
+    KIRQL OldIrql;
+    KeAcquireSpinLock(&m_DispiLock, &OldIrql);
+
+    // For seamless boot, the mode set by the firmware stays on screen while the capabilities are read
+    USHORT Enable = VBE_DISPI_DISABLED;
+    if (KeepMode) {
+        Enable = DispiReadUShort(VBE_DISPI_INDEX_ENABLE) & (VBE_DISPI_ENABLED | VBE_DISPI_LFB_ENABLED);
+    }
+
+    DispiWriteUShort(VBE_DISPI_INDEX_ENABLE, Enable | VBE_DISPI_GETCAPS);
+    BOOLEAN Reported = DispiReadUShort(VBE_DISPI_INDEX_ENABLE) == (Enable | VBE_DISPI_GETCAPS);
+    if (Reported) {
+        m_VbeInfo.MaxXres = DispiReadUShort(VBE_DISPI_INDEX_XRES);
+        m_VbeInfo.MaxYres = DispiReadUShort(VBE_DISPI_INDEX_YRES);
+        m_VbeInfo.MaxBpp = DispiReadUShort(VBE_DISPI_INDEX_BPP);
+    }
+    DispiWriteUShort(VBE_DISPI_INDEX_ENABLE, Enable);
+
+    KeReleaseSpinLock(&m_DispiLock, OldIrql);
+    return Reported;
+}
+
+NTSTATUS BASIC_DISPLAY_DRIVER::SetVBEMode(USHORT ModeNumber, USHORT VirtualHeight) {
     if (ModeNumber >= m_VbeInfo.ModeCount) {
         return STATUS_INVALID_PARAMETER;
     }
@@ -148,6 +203,9 @@ NTSTATUS BASIC_DISPLAY_DRIVER::SetVBEMode(USHORT ModeNumber) {
     USHORT Height = m_VbeInfo.Modes[ModeNumber].Height;
     USHORT Bpp = m_VbeInfo.Modes[ModeNumber].BitsPerPixel;
 
+    KIRQL OldIrql;
+    KeAcquireSpinLock(&m_DispiLock, &OldIrql);
+
     DispiWriteUShort(VBE_DISPI_INDEX_ENABLE, VBE_DISPI_DISABLED);
     DispiWriteUShort(VBE_DISPI_INDEX_BANK, 0);
     DispiWriteUShort(VBE_DISPI_INDEX_X_OFFSET, 0);
@@ -155,11 +213,93 @@ NTSTATUS BASIC_DISPLAY_DRIVER::SetVBEMode(USHORT ModeNumber) {
 
     DispiWriteUShort(VBE_DISPI_INDEX_BPP, Bpp);
     DispiWriteUShort(VBE_DISPI_INDEX_XRES, Width);
-    DispiWriteUShort(VBE_DISPI_INDEX_VIRT_WIDTH, Width);
     DispiWriteUShort(VBE_DISPI_INDEX_YRES, Height);
-    DispiWriteUShort(VBE_DISPI_INDEX_VIRT_HEIGHT, Height);
 
-    DispiWriteUShort(VBE_DISPI_INDEX_ENABLE, VBE_DISPI_ENABLED | VBE_DISPI_LFB_ENABLED);
+    // Enabling resets the virtual size to the resolution, so it is set afterwards. The device would clear all of video
+    // memory, BlackOutScreen only clears the visible frame when it wasn't zeroed already.
+    DispiWriteUShort(VBE_DISPI_INDEX_ENABLE, VBE_DISPI_ENABLED | VBE_DISPI_LFB_ENABLED | VBE_DISPI_NOCLEARMEM);
+    BOOLEAN Set = WriteVBEVirtualHeight(ModeNumber, VirtualHeight);
 
+    KeReleaseSpinLock(&m_DispiLock, OldIrql);
+
+    if (!Set) {
+        BDD_LOG_WARNING("Mode %hu cannot have a virtual height of %hu", ModeNumber, VirtualHeight);
+        return STATUS_NOT_SUPPORTED;
+    }
     return STATUS_SUCCESS;
 }
+
+NTSTATUS BASIC_DISPLAY_DRIVER::SetVBEVirtualHeight(USHORT ModeNumber, USHORT VirtualHeight) {
+    if (ModeNumber >= m_VbeInfo.ModeCount) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    KIRQL OldIrql;
+    KeAcquireSpinLock(&m_DispiLock, &OldIrql);
+    BOOLEAN Set = WriteVBEVirtualHeight(ModeNumber, VirtualHeight);
+    KeReleaseSpinLock(&m_DispiLock, OldIrql);
+
+    if (!Set) {
+        BDD_LOG_WARNING("Mode %hu cannot have a virtual height of %hu", ModeNumber, VirtualHeight);
+        return STATUS_NOT_SUPPORTED;
+    }
+    return STATUS_SUCCESS;
+}
+
+BOOLEAN BASIC_DISPLAY_DRIVER::WriteVBEVirtualHeight(USHORT ModeNumber, USHORT VirtualHeight) {
+    // Rows past the visible height hold the back frame or the rows a scroll pans to
+    DispiWriteUShort(VBE_DISPI_INDEX_VIRT_HEIGHT, VirtualHeight);
+
+    // The device clamps the virtual height to its video memory
+    return VirtualHeight <= m_VbeInfo.Modes[ModeNumber].Height ||
+        DispiReadUShort(VBE_DISPI_INDEX_VIRT_HEIGHT) >= VirtualHeight;
+}
+
+VOID BASIC_DISPLAY_DRIVER::SaveVBEState(_Out_writes_(VBE_DISPI_INDEX_Y_OFFSET + 1) USHORT *pRegisters) {
+    KIRQL OldIrql;
+    KeAcquireSpinLock(&m_DispiLock, &OldIrql);
+    for (USHORT Index = VBE_DISPI_INDEX_ID; Index <= VBE_DISPI_INDEX_Y_OFFSET; Index++) {
+        pRegisters[Index] = DispiReadUShort(Index);
+    }
+    KeReleaseSpinLock(&m_DispiLock, OldIrql);
+}
+
+NTSTATUS BASIC_DISPLAY_DRIVER::RestoreVBEState(_In_reads_(VBE_DISPI_INDEX_Y_OFFSET + 1) CONST USHORT *pRegisters) {
+    KIRQL OldIrql;
+    KeAcquireSpinLock(&m_DispiLock, &OldIrql);
+
+    // Same order as SetVBEMode, the caller repaints the visible frame so video memory is not cleared
+    DispiWriteUShort(VBE_DISPI_INDEX_ENABLE, VBE_DISPI_DISABLED);
+    DispiWriteUShort(VBE_DISPI_INDEX_BANK, pRegisters[VBE_DISPI_INDEX_BANK]);
+
+    DispiWriteUShort(VBE_DISPI_INDEX_BPP, pRegisters[VBE_DISPI_INDEX_BPP]);
+    DispiWriteUShort(VBE_DISPI_INDEX_XRES, pRegisters[VBE_DISPI_INDEX_XRES]);
+    DispiWriteUShort(VBE_DISPI_INDEX_YRES, pRegisters[VBE_DISPI_INDEX_YRES]);
+
+    DispiWriteUShort(VBE_DISPI_INDEX_ENABLE, pRegisters[VBE_DISPI_INDEX_ENABLE] | VBE_DISPI_NOCLEARMEM);
+
+    DispiWriteUShort(VBE_DISPI_INDEX_VIRT_WIDTH, pRegisters[VBE_DISPI_INDEX_VIRT_WIDTH]);
+    DispiWriteUShort(VBE_DISPI_INDEX_VIRT_HEIGHT, pRegisters[VBE_DISPI_INDEX_VIRT_HEIGHT]);
+    DispiWriteUShort(VBE_DISPI_INDEX_X_OFFSET, pRegisters[VBE_DISPI_INDEX_X_OFFSET]);
+    DispiWriteUShort(VBE_DISPI_INDEX_Y_OFFSET, pRegisters[VBE_DISPI_INDEX_Y_OFFSET]);
+
+    BOOLEAN Restored = DispiReadUShort(VBE_DISPI_INDEX_XRES) == pRegisters[VBE_DISPI_INDEX_XRES] &&
+        DispiReadUShort(VBE_DISPI_INDEX_YRES) == pRegisters[VBE_DISPI_INDEX_YRES] &&
+        DispiReadUShort(VBE_DISPI_INDEX_BPP) == pRegisters[VBE_DISPI_INDEX_BPP] &&
+        DispiReadUShort(VBE_DISPI_INDEX_VIRT_HEIGHT) == pRegisters[VBE_DISPI_INDEX_VIRT_HEIGHT];
+
+    KeReleaseSpinLock(&m_DispiLock, OldIrql);
+
+    if (!Restored) {
+        BDD_LOG_WARNING(
+            "Restoring mode %hux%hux%hu failed",
+            pRegisters[VBE_DISPI_INDEX_XRES],
+            pRegisters[VBE_DISPI_INDEX_YRES],
+            pRegisters[VBE_DISPI_INDEX_BPP]);
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+#pragma code_seg(pop) // End Non-Paged Code
@@ -2,9 +2,16 @@
 
 // Based on the Microsoft KMDOD example
 // Copyright (c) 2010 Microsoft Corporation
+// Copyright 2026 Vates.
 
 #include "bdd.hxx"
 
+#if defined(_M_AMD64)
+#include <intrin.h>
+#elif defined(_M_ARM64)
+#include <arm64_neon.h>
+#endif
+
 // For the following macros, c must be a UCHAR.
 #define UPPER_6_BITS(c) (((c) & rMaskTable[6 - 1]) >> 2)
 #define UPPER_5_BITS(c) (((c) & rMaskTable[5 - 1]) >> 3)
@@ -53,23 +60,251 @@ BYTE rMaskTable[BITS_PER_BYTE] = {0x80, 0xc0, 0xe0, 0xf0, 0xf8, 0xfc, 0xfe, 0xff
 // Bit of Idx is 1, with bit count starting at high order
 BYTE PixelMask[BITS_PER_BYTE] = {0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01};
 
+// Processor features that the row kernels below depend on, detected by BltInitialize
+#define BLT_CPU_SSE2 0x00000001
+#define BLT_CPU_AVX 0x00000002 // Processor support and YMM state enabled by the OS
+#define BLT_CPU_ERMS 0x00000004
+#define BLT_CPU_NEON 0x00000008
+
+ULONG BltCpuFeatures = 0;
+
+typedef VOID BLT_ROW_COPY(_Out_writes_bytes_(Bytes) BYTE *pDst, _In_reads_bytes_(Bytes) CONST BYTE *pSrc, SIZE_T Bytes);
+
+static VOID
+CopyRowMemcpy(_Out_writes_bytes_(Bytes) BYTE *pDst, _In_reads_bytes_(Bytes) CONST BYTE *pSrc, SIZE_T Bytes) {
+    RtlCopyMemory(pDst, pSrc, Bytes);
+}
+
+#if defined(_M_AMD64)
 /****************************Internal*Routine******************************\
- * CopyBits32_32
+ * CopyRowNtSse2
  *
  *
- * Copies rectangles from one surface to another. Both surfaces must have
- * the same resolution.
+ * Copies one row of 32bpp pixels into write-combined memory with
+ * non-temporal stores. The destination is first brought up to a 64 byte
+ * boundary so that every iteration of the main loop fills a whole
+ * write-combining buffer. The stores are weakly ordered, BltFlush must be
+ * called once all the rows of a present have been written.
  *
- * OffsetX, OffsetY - to add to the rectangle coordinates.
+\**************************************************************************/
+
+static VOID
+CopyRowNtSse2(_Out_writes_bytes_(Bytes) BYTE *pDst, _In_reads_bytes_(Bytes) CONST BYTE *pSrc, SIZE_T Bytes) {
+    NT_ASSERT(((ULONG_PTR)pDst & 3) == 0);
+    NT_ASSERT((Bytes & 3) == 0);
+
+    while (Bytes >= 4 && ((ULONG_PTR)pDst & 15) != 0) {
+        _mm_stream_si32((int *)pDst, *(CONST int *)pSrc);
+        pDst += 4;
+        pSrc += 4;
+        Bytes -= 4;
+    }
+
+    while (Bytes >= 16 && ((ULONG_PTR)pDst & 63) != 0) {
+        _mm_stream_si128((__m128i *)pDst, _mm_loadu_si128((CONST __m128i *)pSrc));
+        pDst += 16;
+        pSrc += 16;
+        Bytes -= 16;
+    }
+
+    while (Bytes >= 64) {
+        __m128i v0 = _mm_loadu_si128((CONST __m128i *)(pSrc + 0));
+        __m128i v1 = _mm_loadu_si128((CONST __m128i *)(pSrc + 16));
+        __m128i v2 = _mm_loadu_si128((CONST __m128i *)(pSrc + 32));
+        __m128i v3 = _mm_loadu_si128((CONST __m128i *)(pSrc + 48));
+        _mm_stream_si128((__m128i *)(pDst + 0), v0);
+        _mm_stream_si128((__m128i *)(pDst + 16), v1);
+        _mm_stream_si128((__m128i *)(pDst + 32), v2);
+        _mm_stream_si128((__m128i *)(pDst + 48), v3);
+        pDst += 64;
+        pSrc += 64;
+        Bytes -= 64;
+    }
+
+    while (Bytes >= 16) {
+        _mm_stream_si128((__m128i *)pDst, _mm_loadu_si128((CONST __m128i *)pSrc));
+        pDst += 16;
+        pSrc += 16;
+        Bytes -= 16;
+    }
+
+    while (Bytes >= 4) {
+        _mm_stream_si32((int *)pDst, *(CONST int *)pSrc);
+        pDst += 4;
+        pSrc += 4;
+        Bytes -= 4;
+    }
+}
+
+/****************************Internal*Routine******************************\
+ * CopyRowNtAvx
  *
- * Copied from %SDXROOT%\windows\Core\dxkernel\cdd\enable.cxx (CopySurfBits)
+ *
+ * Same as CopyRowNtSse2 with 256-bit registers. Only callable between
+ * KeSaveExtendedProcessorState and KeRestoreExtendedProcessorState.
  *
 \**************************************************************************/
 
-VOID CopyBits32_32(BLT_INFO *pDst, CONST BLT_INFO *pSrc, UINT NumRects, _In_reads_(NumRects) CONST RECT *pRects) {
+static VOID
+CopyRowNtAvx(_Out_writes_bytes_(Bytes) BYTE *pDst, _In_reads_bytes_(Bytes) CONST BYTE *pSrc, SIZE_T Bytes) {
+    NT_ASSERT(((ULONG_PTR)pDst & 3) == 0);
+    NT_ASSERT((Bytes & 3) == 0);
+
+    while (Bytes >= 4 && ((ULONG_PTR)pDst & 15) != 0) {
+        _mm_stream_si32((int *)pDst, *(CONST int *)pSrc);
+        pDst += 4;
+        pSrc += 4;
+        Bytes -= 4;
+    }
+
+    while (Bytes >= 16 && ((ULONG_PTR)pDst & 63) != 0) {
+        _mm_stream_si128((__m128i *)pDst, _mm_loadu_si128((CONST __m128i *)pSrc));
+        pDst += 16;
+        pSrc += 16;
+        Bytes -= 16;
+    }
+
+    while (Bytes >= 64) {
+        __m256i v0 = _mm256_loadu_si256((CONST __m256i *)(pSrc + 0));
+        __m256i v1 = _mm256_loadu_si256((CONST __m256i *)(pSrc + 32));
+        _mm256_stream_si256((__m256i *)(pDst + 0), v0);
+        _mm256_stream_si256((__m256i *)(pDst + 32), v1);
+        pDst += 64;
+        pSrc += 64;
+        Bytes -= 64;
+    }
+
+    while (Bytes >= 16) {
+        _mm_stream_si128((__m128i *)pDst, _mm_loadu_si128((CONST __m128i *)pSrc));
+        pDst += 16;
+        pSrc += 16;
+        Bytes -= 16;
+    }
+
+    while (Bytes >= 4) {
+        _mm_stream_si32((int *)pDst, *(CONST int *)pSrc);
+        pDst += 4;
+        pSrc += 4;
+        Bytes -= 4;
+    }
+}
+
+/****************************Internal*Routine******************************\
+ * CopyRowErms
+ *
+ *
+ * Copies one row with a single rep movsb, which processors with enhanced
+ * rep movsb/stosb turn into full cache line writes on their own.
+ *
+\**************************************************************************/
+
+static VOID
+CopyRowErms(_Out_writes_bytes_(Bytes) BYTE *pDst, _In_reads_bytes_(Bytes) CONST BYTE *pSrc, SIZE_T Bytes) {
+    __movsb(pDst, pSrc, Bytes);
+}
+#endif // _M_AMD64
+
+#if defined(_M_ARM64)
+/****************************Internal*Routine******************************\
+ * CopyRowNeon
+ *
+ *
+ * Copies one row with 64 bytes worth of NEON loads and stores per
+ * iteration. The framebuffer is mapped Normal Non-Cacheable, so the stores
+ * are gathered without needing non-temporal hints.
+ *
+\**************************************************************************/
+
+static VOID
+CopyRowNeon(_Out_writes_bytes_(Bytes) BYTE *pDst, _In_reads_bytes_(Bytes) CONST BYTE *pSrc, SIZE_T Bytes) {
+    while (Bytes >= 64) {
+        uint8x16_t v0 = vld1q_u8(pSrc + 0);
+        uint8x16_t v1 = vld1q_u8(pSrc + 16);
+        uint8x16_t v2 = vld1q_u8(pSrc + 32);
+        uint8x16_t v3 = vld1q_u8(pSrc + 48);
+        vst1q_u8(pDst + 0, v0);
+        vst1q_u8(pDst + 16, v1);
+        vst1q_u8(pDst + 32, v2);
+        vst1q_u8(pDst + 48, v3);
+        pDst += 64;
+        pSrc += 64;
+        Bytes -= 64;
+    }
+
+    while (Bytes >= 16) {
+        vst1q_u8(pDst, vld1q_u8(pSrc));
+        pDst += 16;
+        pSrc += 16;
+        Bytes -= 16;
+    }
+
+    while (Bytes >= 4) {
+        *(UINT32 *)pDst = *(CONST UINT32 *)pSrc;
+        pDst += 4;
+        pSrc += 4;
+        Bytes -= 4;
+    }
+}
+#endif // _M_ARM64
+
+typedef struct _BLT_ROW_KERNEL {
+    PCSTR Name;
+    BLT_ROW_COPY *pfnCopyRow;
+    ULONG CpuFeatures;   // BLT_CPU_* flags that must all be present
+    BOOLEAN NonTemporal; // Needs BltFlush and a 4 byte aligned destination
+} BLT_ROW_KERNEL;
+
+static CONST BLT_ROW_KERNEL BltRowKernels[] = {
+    {"memcpy", CopyRowMemcpy, 0, FALSE},
+#if defined(_M_AMD64)
+    {"erms", CopyRowErms, BLT_CPU_ERMS, FALSE},
+    {"sse2", CopyRowNtSse2, BLT_CPU_SSE2, TRUE},
+    {"avx", CopyRowNtAvx, BLT_CPU_AVX, TRUE},
+#elif defined(_M_ARM64)
+    {"neon", CopyRowNeon, BLT_CPU_NEON, FALSE},
+#endif
+};
+
+// Rows are classified by their length, as the fastest way to fill the write-combining buffers differs between narrow
+// rects (caret, text) and full-width ones
+typedef enum _BLT_ROW_CLASS {
+    BLT_ROW_CLASS_SMALL,  // Less than 256 bytes
+    BLT_ROW_CLASS_MEDIUM, // Less than 4 KiB
+    BLT_ROW_CLASS_LARGE,
+    BLT_ROW_CLASS_COUNT
+} BLT_ROW_CLASS;
+
+static CONST PCSTR BltRowClassNames[BLT_ROW_CLASS_COUNT] = {"small", "medium", "large"};
+
+static BLT_ROW_CLASS BltRowClass(SIZE_T Bytes) {
+    if (Bytes < 256) {
+        return BLT_ROW_CLASS_SMALL;
+    } else if (Bytes < 4096) {
+        return BLT_ROW_CLASS_MEDIUM;
+    } else {
+        return BLT_ROW_CLASS_LARGE;
+    }
+}
+
+// Index into BltRowKernels of the kernel used for each row class, picked by BltCalibrate. The first table may use any
+// kernel, the second one is used where the AVX state cannot be saved.
+static UCHAR BltRowKernelForClass[BLT_ROW_CLASS_COUNT];
+static UCHAR BltRowKernelForClassNoAvx[BLT_ROW_CLASS_COUNT];
+static BOOLEAN BltRowKernelsUseAvx = FALSE;
+
+// Copies the rects of CopyBits32_32 with the row kernels picked for each row class by pKernelForClass
+static VOID CopyBits32_32Rows(
+    BLT_INFO *pDst,
+    CONST BLT_INFO *pSrc,
+    UINT NumRects,
+    _In_reads_(NumRects) CONST RECT *pRects,
+    _In_reads_(BLT_ROW_CLASS_COUNT) CONST UCHAR *pKernelForClass) {
     NT_ASSERT((pDst->BitsPerPel == 32) && (pSrc->BitsPerPel == 32));
     NT_ASSERT((pDst->Rotation == D3DKMDT_VPPR_IDENTITY) && (pSrc->Rotation == D3DKMDT_VPPR_IDENTITY));
 
+    // Non-temporal stores need a pixel aligned destination, which a centered mode of odd width difference doesn't give
+    BOOLEAN DstAligned = ((ULONG_PTR)pDst->pBits & 3) == 0 && (pDst->Pitch & 3) == 0;
+
     for (UINT iRect = 0; iRect < NumRects; iRect++) {
         CONST RECT *pRect = &pRects[iRect];
 
@@ -84,14 +319,42 @@ VOID CopyBits32_32(BLT_INFO *pDst, CONST BLT_INFO *pSrc, UINT NumRects, _In_read
         CONST BYTE *pStartSrc =
             ((BYTE *)pSrc->pBits + (pRect->top + pSrc->Offset.y) * pSrc->Pitch + (pRect->left + pSrc->Offset.x) * 4);
 
+        CONST BLT_ROW_KERNEL *pKernel = &BltRowKernels[pKernelForClass[BltRowClass(BytesToCopy)]];
+        BLT_ROW_COPY *pfnCopyRow = (pKernel->NonTemporal && !DstAligned) ? CopyRowMemcpy : pKernel->pfnCopyRow;
+
         for (UINT i = 0; i < NumRows; ++i) {
-            RtlCopyMemory(pStartDst, pStartSrc, BytesToCopy);
+            pfnCopyRow(pStartDst, pStartSrc, BytesToCopy);
             pStartDst += pDst->Pitch;
             pStartSrc += pSrc->Pitch;
         }
     }
 }
 
+/****************************Internal*Routine******************************\
+ * CopyBits32_32
+ *
+ *
+ * Copies rectangles from one surface to another. Both surfaces must have
+ * the same resolution.
+ *
+ * OffsetX, OffsetY - to add to the rectangle coordinates.
+ *
+ * Copied from %SDXROOT%\windows\Core\dxkernel\cdd\enable.cxx (CopySurfBits)
+ *
+\**************************************************************************/
+
+VOID CopyBits32_32(BLT_INFO *pDst, CONST BLT_INFO *pSrc, UINT NumRects, _In_reads_(NumRects) CONST RECT *pRects) {
+    CopyBits32_32Rows(pDst, pSrc, NumRects, pRects, BltRowKernelForClassNoAvx);
+}
+
+#if defined(_M_AMD64)
+// Must only be called with the AVX state saved
+static VOID
+CopyBits32_32Avx(BLT_INFO *pDst, CONST BLT_INFO *pSrc, UINT NumRects, _In_reads_(NumRects) CONST RECT *pRects) {
+    CopyBits32_32Rows(pDst, pSrc, NumRects, pRects, BltRowKernelForClass);
+}
+#endif
+
 VOID GetPitches(_In_ CONST BLT_INFO *pBltInfo, _Out_ LONG *pPixelPitch, _Out_ LONG *pRowPitch) {
     switch (pBltInfo->Rotation) {
     case D3DKMDT_VPPR_IDENTITY: {
@@ -156,14 +419,227 @@ BYTE *GetRowStart(_In_ CONST BLT_INFO *pBltInfo, CONST RECT *pRect) {
     return pRet;
 }
 
+#if defined(_M_AMD64)
+// Transposes a 4x4 block of 32bpp pixels, rows in R0-R3 become columns
+#define TRANSPOSE_4X4_32(R0, R1, R2, R3) \
+    do { \
+        __m128i T0 = _mm_unpacklo_epi32(R0, R1); \
+        __m128i T1 = _mm_unpacklo_epi32(R2, R3); \
+        __m128i T2 = _mm_unpackhi_epi32(R0, R1); \
+        __m128i T3 = _mm_unpackhi_epi32(R2, R3); \
+        R0 = _mm_unpacklo_epi64(T0, T1); \
+        R1 = _mm_unpackhi_epi64(T0, T1); \
+        R2 = _mm_unpacklo_epi64(T2, T3); \
+        R3 = _mm_unpackhi_epi64(T2, T3); \
+    } while (0)
+
+// Reverses the order of the 4 pixels in V
+#define REVERSE_4_32(V) _mm_shuffle_epi32(V, _MM_SHUFFLE(0, 1, 2, 3))
+#endif
+
+/****************************Internal*Routine******************************\
+ * CopyBits32_32Transpose
+ *
+ *
+ * Blt function for 32bpp to 32bpp with a 90 or 270 degree rotation of the
+ * destination. A column of the source is a row of the destination, so the
+ * source is walked in blocks of 16 rows by 4 columns: each block is
+ * transposed in registers and written out as 4 destination rows of 64
+ * contiguous bytes, instead of 64 pixels on 64 different cache lines.
+ * Columns and rows that do not fill a block are copied one pixel at a time.
+ *
+ * For 90 degrees the destination row runs in the same direction as the
+ * source column, for 270 degrees (Reverse) it runs backwards.
+ *
+\**************************************************************************/
+
+template <BOOLEAN Reverse>
+static VOID
+CopyBits32_32Transpose(BLT_INFO *pDst, CONST BLT_INFO *pSrc, UINT NumRects, _In_reads_(NumRects) CONST RECT *pRects) {
+    LONG DstPixelPitch = 0;
+    LONG DstRowPitch = 0;
+    LONG SrcPixelPitch = 0;
+    LONG SrcRowPitch = 0;
+
+    GetPitches(pDst, &DstPixelPitch, &DstRowPitch);
+    GetPitches(pSrc, &SrcPixelPitch, &SrcRowPitch);
+
+    NT_ASSERT(DstRowPitch == (Reverse ? -4 : 4));
+    NT_ASSERT(SrcPixelPitch == 4);
+
+    for (UINT iRect = 0; iRect < NumRects; iRect++) {
+        CONST RECT *pRect = &pRects[iRect];
+
+        NT_ASSERT(pRect->right >= pRect->left);
+        NT_ASSERT(pRect->bottom >= pRect->top);
+
+        UINT NumPixels = pRect->right - pRect->left;
+        UINT NumRows = pRect->bottom - pRect->top;
+
+        BYTE *pDstOrigin = GetRowStart(pDst, pRect);
+        CONST BYTE *pSrcOrigin = GetRowStart(pSrc, pRect);
+
+#if defined(_M_AMD64)
+        UINT BlockRows = NumRows & ~15u;
+        UINT BlockPixels = NumPixels & ~3u;
+#else
+        UINT BlockRows = 0;
+        UINT BlockPixels = 0;
+#endif
+
+        for (UINT y = 0; y < BlockRows; y += 16) {
+#if defined(_M_AMD64)
+            for (UINT x = 0; x < BlockPixels; x += 4) {
+                CONST BYTE *pSrcBlock = pSrcOrigin + (LONG_PTR)y * SrcRowPitch + x * 4;
+                __m128i Columns[4][4];
+
+                for (UINT Quad = 0; Quad < 4; Quad++) {
+                    CONST BYTE *pSrcQuad = pSrcBlock + (LONG_PTR)(Quad * 4) * SrcRowPitch;
+                    __m128i R0 = _mm_loadu_si128((CONST __m128i *)(pSrcQuad));
+                    __m128i R1 = _mm_loadu_si128((CONST __m128i *)(pSrcQuad + SrcRowPitch));
+                    __m128i R2 = _mm_loadu_si128((CONST __m128i *)(pSrcQuad + 2 * (LONG_PTR)SrcRowPitch));
+                    __m128i R3 = _mm_loadu_si128((CONST __m128i *)(pSrcQuad + 3 * (LONG_PTR)SrcRowPitch));
+                    TRANSPOSE_4X4_32(R0, R1, R2, R3);
+                    if constexpr (Reverse) {
+                        // Destination runs from source row y + 15 down to y, so the last quad goes first
+                        Columns[0][3 - Quad] = REVERSE_4_32(R0);
+                        Columns[1][3 - Quad] = REVERSE_4_32(R1);
+                        Columns[2][3 - Quad] = REVERSE_4_32(R2);
+                        Columns[3][3 - Quad] = REVERSE_4_32(R3);
+                    } else {
+                        Columns[0][Quad] = R0;
+                        Columns[1][Quad] = R1;
+                        Columns[2][Quad] = R2;
+                        Columns[3][Quad] = R3;
+                    }
+                }
+
+                for (UINT Column = 0; Column < 4; Column++) {
+                    // Lowest address of the 16 destination pixels for this source column
+                    BYTE *pDstRow = pDstOrigin + (LONG_PTR)(x + Column) * DstPixelPitch +
+                        (LONG_PTR)(Reverse ? (y + 15) : y) * DstRowPitch;
+                    _mm_storeu_si128((__m128i *)(pDstRow + 0), Columns[Column][0]);
+                    _mm_storeu_si128((__m128i *)(pDstRow + 16), Columns[Column][1]);
+                    _mm_storeu_si128((__m128i *)(pDstRow + 32), Columns[Column][2]);
+                    _mm_storeu_si128((__m128i *)(pDstRow + 48), Columns[Column][3]);
+                }
+            }
+#endif
+
+            for (UINT Row = y; Row < y + 16; Row++) {
+                CONST UINT32 *pSrcPixel = (CONST UINT32 *)(pSrcOrigin + (LONG_PTR)Row * SrcRowPitch);
+                BYTE *pDstPixel = pDstOrigin + (LONG_PTR)Row * DstRowPitch;
+                for (UINT x = BlockPixels; x < NumPixels; x++) {
+                    *(UINT32 *)(pDstPixel + (LONG_PTR)x * DstPixelPitch) = pSrcPixel[x];
+                }
+            }
+        }
+
+        for (UINT Row = BlockRows; Row < NumRows; Row++) {
+            CONST UINT32 *pSrcPixel = (CONST UINT32 *)(pSrcOrigin + (LONG_PTR)Row * SrcRowPitch);
+            BYTE *pDstPixel = pDstOrigin + (LONG_PTR)Row * DstRowPitch;
+            for (UINT x = 0; x < NumPixels; x++) {
+                *(UINT32 *)(pDstPixel + (LONG_PTR)x * DstPixelPitch) = pSrcPixel[x];
+            }
+        }
+    }
+}
+
+/****************************Internal*Routine******************************\
+ * CopyBits32_32Reverse
+ *
+ *
+ * Blt function for 32bpp to 32bpp with a 180 degree rotation of the
+ * destination. Every source row lands on a single destination row in
+ * reverse order, so 4 pixels are loaded, swapped in a register and stored
+ * at once.
+ *
+\**************************************************************************/
+
+static VOID
+CopyBits32_32Reverse(BLT_INFO *pDst, CONST BLT_INFO *pSrc, UINT NumRects, _In_reads_(NumRects) CONST RECT *pRects) {
+    LONG DstPixelPitch = 0;
+    LONG DstRowPitch = 0;
+    LONG SrcPixelPitch = 0;
+    LONG SrcRowPitch = 0;
+
+    GetPitches(pDst, &DstPixelPitch, &DstRowPitch);
+    GetPitches(pSrc, &SrcPixelPitch, &SrcRowPitch);
+
+    NT_ASSERT(DstPixelPitch == -4);
+    NT_ASSERT(SrcPixelPitch == 4);
+
+    for (UINT iRect = 0; iRect < NumRects; iRect++) {
+        CONST RECT *pRect = &pRects[iRect];
+
+        NT_ASSERT(pRect->right >= pRect->left);
+        NT_ASSERT(pRect->bottom >= pRect->top);
+
+        UINT NumPixels = pRect->right - pRect->left;
+        UINT NumRows = pRect->bottom - pRect->top;
+
+        BYTE *pDstRow = GetRowStart(pDst, pRect);
+        CONST BYTE *pSrcRow = GetRowStart(pSrc, pRect);
+
+        for (UINT y = 0; y < NumRows; y++) {
+            // pDstRow is the address of the first source pixel, the following ones go to lower addresses
+            BYTE *pDstPixel = pDstRow;
+            CONST UINT32 *pSrcPixel = (CONST UINT32 *)pSrcRow;
+            UINT x = 0;
+
+#if defined(_M_AMD64)
+            for (; x + 4 <= NumPixels; x += 4) {
+                __m128i V = _mm_loadu_si128((CONST __m128i *)&pSrcPixel[x]);
+                _mm_storeu_si128((__m128i *)(pDstPixel - (LONG_PTR)(x + 3) * 4), REVERSE_4_32(V));
+            }
+#endif
+
+            for (; x < NumPixels; x++) {
+                *(UINT32 *)(pDstPixel - (LONG_PTR)x * 4) = pSrcPixel[x];
+            }
+
+            pDstRow += DstRowPitch;
+            pSrcRow += SrcRowPitch;
+        }
+    }
+}
+
 /****************************Internal*Routine******************************\
- * CopyBitsGeneric
+ * ConvertPixel
  *
  *
- * Blt function which can handle a rotated dst/src, offset rects in dst/src
- * and bpp combinations of:
+ * Converts a single pixel between the bpp combinations of CopyBits. All
+ * the branches are resolved at compile time.
+ *
+\**************************************************************************/
+
+template <UINT DstBpp, UINT SrcBpp> static FORCEINLINE VOID ConvertPixel(BYTE *pDstPixel, CONST BYTE *pSrcPixel) {
+    if constexpr ((DstBpp == 24) || (SrcBpp == 24)) {
+        pDstPixel[0] = pSrcPixel[0];
+        pDstPixel[1] = pSrcPixel[1];
+        pDstPixel[2] = pSrcPixel[2];
+        // pPixel[3] is the alpha channel and is ignored for whichever of Src/Dst is 32bpp
+    } else if constexpr ((DstBpp == 32) && (SrcBpp == 32)) {
+        *(UINT32 *)pDstPixel = *(CONST UINT32 *)pSrcPixel;
+    } else if constexpr ((DstBpp == 32) && (SrcBpp == 16)) {
+        *(UINT32 *)pDstPixel = CONVERT_16BPP_TO_32BPP(*(CONST UINT16 *)pSrcPixel);
+    } else if constexpr ((DstBpp == 16) && (SrcBpp == 32)) {
+        *(UINT16 *)pDstPixel = (UINT16)CONVERT_32BPP_TO_16BPP(pSrcPixel);
+    } else if constexpr ((DstBpp == 8) && (SrcBpp == 32)) {
+        *pDstPixel = (BYTE)CONVERT_32BPP_TO_8BPP(pSrcPixel);
+    } else {
+        static_assert(DstBpp == 0, "Unsupported bpp combination");
+    }
+}
+
+/****************************Internal*Routine******************************\
+ * CopyBits
+ *
+ *
+ * Blt function which can handle a rotated dst, offset rects in dst/src and
+ * bpp combinations of:
  *   dst | src
- *    32 | 32   // For identity rotation this is much faster in CopyBits32_32
+ *    32 | 32   // Only instantiated where no SIMD kernel above applies
  *    32 | 24
  *    32 | 16
  *    24 | 32
@@ -171,16 +647,30 @@ BYTE *GetRowStart(_In_ CONST BLT_INFO *pBltInfo, CONST RECT *pRect) {
  *     8 | 32
  *    24 | 24   // untested
  *
+ * One instance is generated per (dst bpp, src bpp, dst rotation), so the
+ * inner loop has no per-pixel branches and constant pixel strides for the
+ * identity and 180 degree rotations. The source is never rotated.
+ *
 \**************************************************************************/
 
-VOID CopyBitsGeneric(BLT_INFO *pDst, CONST BLT_INFO *pSrc, UINT NumRects, _In_reads_(NumRects) CONST RECT *pRects) {
-    LONG DstPixelPitch = 0;
-    LONG DstRowPitch = 0;
-    LONG SrcPixelPitch = 0;
-    LONG SrcRowPitch = 0;
+template <UINT DstBpp, UINT SrcBpp, D3DKMDT_VIDPN_PRESENT_PATH_ROTATION Rotation>
+static VOID CopyBits(BLT_INFO *pDst, CONST BLT_INFO *pSrc, UINT NumRects, _In_reads_(NumRects) CONST RECT *pRects) {
+    constexpr LONG DstBytesPerPixel = DstBpp / BITS_PER_BYTE;
+    constexpr LONG SrcBytesPerPixel = SrcBpp / BITS_PER_BYTE;
 
-    GetPitches(pDst, &DstPixelPitch, &DstRowPitch);
-    GetPitches(pSrc, &SrcPixelPitch, &SrcRowPitch);
+    NT_ASSERT((pDst->BitsPerPel == DstBpp) && (pSrc->BitsPerPel == SrcBpp));
+    NT_ASSERT((pDst->Rotation == Rotation) && (pSrc->Rotation == D3DKMDT_VPPR_IDENTITY));
+
+    // Same values as GetPitches, but known at compile time where the rotation allows it
+    CONST LONG DstPixelPitch = (Rotation == D3DKMDT_VPPR_IDENTITY) ? DstBytesPerPixel
+        : (Rotation == D3DKMDT_VPPR_ROTATE180)                      ? -DstBytesPerPixel
+        : (Rotation == D3DKMDT_VPPR_ROTATE90)                       ? -((LONG)pDst->Pitch)
+                                                                    : (LONG)pDst->Pitch;
+    CONST LONG DstRowPitch = (Rotation == D3DKMDT_VPPR_IDENTITY) ? (LONG)pDst->Pitch
+        : (Rotation == D3DKMDT_VPPR_ROTATE180)                    ? -((LONG)pDst->Pitch)
+        : (Rotation == D3DKMDT_VPPR_ROTATE90)                     ? DstBytesPerPixel
+                                                                  : -DstBytesPerPixel;
+    CONST LONG SrcRowPitch = (LONG)pSrc->Pitch;
 
     for (UINT iRect = 0; iRect < NumRects; iRect++) {
         CONST RECT *pRect = &pRects[iRect];
@@ -199,40 +689,9 @@ VOID CopyBitsGeneric(BLT_INFO *pDst, CONST BLT_INFO *pSrc, UINT NumRects, _In_re
             CONST BYTE *pSrcPixel = pSrcRow;
 
             for (UINT x = 0; x < NumPixels; x++) {
-                if ((pDst->BitsPerPel == 24) || (pSrc->BitsPerPel == 24)) {
-                    pDstPixel[0] = pSrcPixel[0];
-                    pDstPixel[1] = pSrcPixel[1];
-                    pDstPixel[2] = pSrcPixel[2];
-                    // pPixel[3] is the alpha channel and is ignored for whichever of Src/Dst is 32bpp
-                } else if (pDst->BitsPerPel == 32) {
-                    if (pSrc->BitsPerPel == 32) {
-                        UINT32 *pDstPixelAs32 = (UINT32 *)pDstPixel;
-                        UINT32 *pSrcPixelAs32 = (UINT32 *)pSrcPixel;
-                        *pDstPixelAs32 = *pSrcPixelAs32;
-                    } else if (pSrc->BitsPerPel == 16) {
-                        UINT32 *pDstPixelAs32 = (UINT32 *)pDstPixel;
-                        UINT16 *pSrcPixelAs16 = (UINT16 *)pSrcPixel;
-
-                        *pDstPixelAs32 = CONVERT_16BPP_TO_32BPP(*pSrcPixelAs16);
-                    } else {
-                        // Invalid pSrc->BitsPerPel on a pDst->BitsPerPel of 32
-                        NT_ASSERT(FALSE);
-                    }
-                } else if (pDst->BitsPerPel == 16) {
-                    NT_ASSERT(pSrc->BitsPerPel == 32);
-
-                    UINT16 *pDstPixelAs16 = (UINT16 *)pDstPixel;
-                    *pDstPixelAs16 = CONVERT_32BPP_TO_16BPP(pSrcPixel);
-                } else if (pDst->BitsPerPel == 8) {
-                    NT_ASSERT(pSrc->BitsPerPel == 32);
-
-                    *pDstPixel = CONVERT_32BPP_TO_8BPP(pSrcPixel);
-                } else {
-                    // Invalid pDst->BitsPerPel
-                    NT_ASSERT(FALSE);
-                }
+                ConvertPixel<DstBpp, SrcBpp>(pDstPixel, pSrcPixel);
                 pDstPixel += DstPixelPitch;
-                pSrcPixel += SrcPixelPitch;
+                pSrcPixel += SrcBytesPerPixel;
             }
 
             pDstRow += DstRowPitch;
@@ -241,6 +700,107 @@ VOID CopyBitsGeneric(BLT_INFO *pDst, CONST BLT_INFO *pSrc, UINT NumRects, _In_re
     }
 }
 
+typedef VOID BLT_FUNCTION(BLT_INFO *pDst, CONST BLT_INFO *pSrc, UINT NumRects, _In_reads_(NumRects) CONST RECT *pRects);
+
+#define BLT_FUNCTIONS_NONE {NULL, NULL, NULL, NULL}
+#define BLT_FUNCTIONS(DstBpp, SrcBpp) \
+    { \
+        CopyBits<DstBpp, SrcBpp, D3DKMDT_VPPR_IDENTITY>, CopyBits<DstBpp, SrcBpp, D3DKMDT_VPPR_ROTATE90>, \
+            CopyBits<DstBpp, SrcBpp, D3DKMDT_VPPR_ROTATE180>, CopyBits<DstBpp, SrcBpp, D3DKMDT_VPPR_ROTATE270> \
+    }
+
+// Indexed by BltBppIndex(dst bpp), BltBppIndex(src bpp), and dst rotation - D3DKMDT_VPPR_IDENTITY
+static constexpr BLT_FUNCTION *BltFunctions[4][4][4] = {
+    // dst 8bpp
+    {BLT_FUNCTIONS_NONE, BLT_FUNCTIONS_NONE, BLT_FUNCTIONS_NONE, BLT_FUNCTIONS(8, 32)},
+    // dst 16bpp
+    {BLT_FUNCTIONS_NONE, BLT_FUNCTIONS_NONE, BLT_FUNCTIONS_NONE, BLT_FUNCTIONS(16, 32)},
+    // dst 24bpp
+    {BLT_FUNCTIONS_NONE, BLT_FUNCTIONS_NONE, BLT_FUNCTIONS(24, 24), BLT_FUNCTIONS(24, 32)},
+    // dst 32bpp
+    {BLT_FUNCTIONS_NONE,
+     BLT_FUNCTIONS(32, 16),
+     BLT_FUNCTIONS(32, 24),
+     {CopyBits32_32, CopyBits32_32Transpose<FALSE>, CopyBits32_32Reverse, CopyBits32_32Transpose<TRUE>}},
+};
+
+static UINT BltBppIndex(UINT BitsPerPel) {
+    switch (BitsPerPel) {
+    case 8:
+        return 0;
+    case 16:
+        return 1;
+    case 24:
+        return 2;
+    case 32:
+        return 3;
+    default:
+        return ARRAYSIZE(BltFunctions);
+    }
+}
+
+// Returns NULL if no Blt function handles this combination of bpp and rotation
+static BLT_FUNCTION *GetBltFunction(CONST BLT_INFO *pDst, CONST BLT_INFO *pSrc) {
+    UINT DstIndex = BltBppIndex(pDst->BitsPerPel);
+    UINT SrcIndex = BltBppIndex(pSrc->BitsPerPel);
+    UINT RotationIndex = (UINT)pDst->Rotation - D3DKMDT_VPPR_IDENTITY;
+
+    if (DstIndex >= ARRAYSIZE(BltFunctions) || SrcIndex >= ARRAYSIZE(BltFunctions[0]) ||
+        RotationIndex >= ARRAYSIZE(BltFunctions[0][0]) || pSrc->Rotation != D3DKMDT_VPPR_IDENTITY) {
+        return NULL;
+    }
+
+    return BltFunctions[DstIndex][SrcIndex][RotationIndex];
+}
+
+// State shared by the rects of one BltBits/BltPresentRects call
+typedef struct _BLT_KERNEL_CONTEXT {
+    BLT_FUNCTION *pfnBlt;
+#if defined(_M_AMD64)
+    XSTATE_SAVE XStateSave;
+    BOOLEAN AvxSaved;
+#endif
+} BLT_KERNEL_CONTEXT;
+
+// Picks the kernel for this combination of surfaces, saving the extended state it needs. Returns FALSE if nothing can
+// be copied, otherwise BltReleaseKernel must be called once done.
+static BOOLEAN BltAcquireKernel(CONST BLT_INFO *pDst, CONST BLT_INFO *pSrc, _Out_ BLT_KERNEL_CONTEXT *pContext) {
+    // The bpp and rotation are the same for all the rects, so the kernel is picked once per call
+    pContext->pfnBlt = GetBltFunction(pDst, pSrc);
+    if (pContext->pfnBlt == NULL) {
+        BDD_LOG_ASSERTION(
+            "Unsupported blt from %u bpp (rotation 0x%x) to %u bpp (rotation 0x%x)",
+            pSrc->BitsPerPel,
+            pSrc->Rotation,
+            pDst->BitsPerPel,
+            pDst->Rotation);
+        return FALSE;
+    }
+
+#if defined(_M_AMD64)
+    // The YMM registers are not preserved for kernel code, so they have to be saved around the AVX kernel. This is not
+    // possible at the IRQL of the bugcheck screen, which then stays on the SSE2 kernel.
+    pContext->AvxSaved = FALSE;
+    if (pContext->pfnBlt == CopyBits32_32 && BltRowKernelsUseAvx && KeGetCurrentIrql() <= DISPATCH_LEVEL &&
+        NT_SUCCESS(KeSaveExtendedProcessorState(XSTATE_MASK_AVX, &pContext->XStateSave))) {
+        pContext->AvxSaved = TRUE;
+        pContext->pfnBlt = CopyBits32_32Avx;
+    }
+#endif
+
+    return TRUE;
+}
+
+static VOID BltReleaseKernel(_In_ BLT_KERNEL_CONTEXT *pContext) {
+#if defined(_M_AMD64)
+    if (pContext->AvxSaved) {
+        KeRestoreExtendedProcessorState(&pContext->XStateSave);
+    }
+#else
+    UNREFERENCED_PARAMETER(pContext);
+#endif
+}
+
 /****************************Internal*Routine******************************\
  * BltBits
  *
@@ -249,16 +809,15 @@ VOID CopyBitsGeneric(BLT_INFO *pDst, CONST BLT_INFO *pSrc, UINT NumRects, _In_re
  *
 \**************************************************************************/
 VOID BltBits(BLT_INFO *pDst, CONST BLT_INFO *pSrc, UINT NumRects, _In_reads_(NumRects) CONST RECT *pRects) {
+    BLT_KERNEL_CONTEXT Kernel;
+    if (!BltAcquireKernel(pDst, pSrc, &Kernel)) {
+        return;
+    }
+
     // pSrc->pBits might be coming from user-mode. User-mode addresses when accessed by kernel need to be protected by a
     // __try/__except.
     __try {
-        if (pDst->BitsPerPel == 32 && pSrc->BitsPerPel == 32 && pDst->Rotation == D3DKMDT_VPPR_IDENTITY &&
-            pSrc->Rotation == D3DKMDT_VPPR_IDENTITY) {
-            // This is by far the most common copy function being called
-            CopyBits32_32(pDst, pSrc, NumRects, pRects);
-        } else {
-            CopyBitsGeneric(pDst, pSrc, NumRects, pRects);
-        }
+        Kernel.pfnBlt(pDst, pSrc, NumRects, pRects);
     }
 #pragma prefast( \
     suppress : __WARNING_EXCEPTIONEXECUTEHANDLER, \
@@ -269,7 +828,934 @@ VOID BltBits(BLT_INFO *pDst, CONST BLT_INFO *pSrc, UINT NumRects, _In_reads_(Num
             pDst->pBits,
             pSrc->pBits);
     }
+
+    BltReleaseKernel(&Kernel);
 }
 
-// END: Non-Paged Code
-#pragma code_seg(pop)
+// Rects of at least this size are split into row bands copied in parallel by the band threads
+#define BLT_PARALLEL_MIN_BYTES (2 * 1024 * 1024)
+#define BLT_MIN_BAND_ROWS 64
+#define BLT_MAX_BAND_THREADS 7
+
+typedef struct _BLT_BAND_THREAD {
+    PKTHREAD pThread;
+    KEVENT StartEvent;
+    RECT Band;
+} BLT_BAND_THREAD;
+
+// The band threads are shared by all the sources, a present finding them busy copies its rects inline
+static struct _BLT_BAND_POOL {
+    ULONG NumThreads;
+    BLT_BAND_THREAD Threads[BLT_MAX_BAND_THREADS];
+    BOOLEAN Stop;
+    LONG volatile Busy;
+
+    // Rect being copied, the band threads attach to Process to read a user-mode source
+    BLT_INFO *pDst;
+    CONST BLT_INFO *pSrc;
+    PEPROCESS Process;
+    LONG volatile Pending;
+    KEVENT DoneEvent;
+} BltBandPool;
+
+/****************************Internal*Routine******************************\
+ * BltCopyBands
+ *
+ *
+ * Splits a rect in bands of rows: the first band is copied by the calling
+ * thread and the others by the band threads, which are waited for even if
+ * the calling thread faults on the source. The rect is copied inline if
+ * it is too short for two bands or the band threads are busy.
+ *
+\**************************************************************************/
+static VOID BltCopyBands(BLT_INFO *pDst, CONST BLT_INFO *pSrc, _In_ CONST RECT *pRect, BLT_FUNCTION *pfnBlt) {
+    LONG Rows = pRect->bottom - pRect->top;
+    ULONG NumBands = min(BltBandPool.NumThreads + 1, (ULONG)max(Rows, 0) / BLT_MIN_BAND_ROWS);
+
+    if (NumBands < 2 || InterlockedCompareExchange(&BltBandPool.Busy, 1, 0) != 0) {
+        pfnBlt(pDst, pSrc, 1, pRect);
+        return;
+    }
+
+    BltBandPool.pDst = pDst;
+    BltBandPool.pSrc = pSrc;
+    BltBandPool.Process = (pSrc->pBits <= MM_HIGHEST_USER_ADDRESS) ? PsGetCurrentProcess() : NULL;
+    BltBandPool.Pending = NumBands - 1;
+    KeClearEvent(&BltBandPool.DoneEvent);
+
+    for (ULONG i = 1; i < NumBands; i++) {
+        RECT *pBand = &BltBandPool.Threads[i - 1].Band;
+        pBand->left = pRect->left;
+        pBand->right = pRect->right;
+        pBand->top = pRect->top + (LONG)((LONG64)Rows * i / NumBands);
+        pBand->bottom = pRect->top + (LONG)((LONG64)Rows * (i + 1) / NumBands);
+        KeSetEvent(&BltBandPool.Threads[i - 1].StartEvent, IO_NO_INCREMENT, FALSE);
+    }
+
+    RECT Band = *pRect;
+    Band.bottom = pRect->top + (LONG)(Rows / NumBands);
+    __try {
+        pfnBlt(pDst, pSrc, 1, &Band);
+    }
+    __finally {
+        // pDst and pSrc must stay valid until all the bands are copied
+        KeWaitForSingleObject(&BltBandPool.DoneEvent, Executive, KernelMode, FALSE, NULL);
+        InterlockedExchange(&BltBandPool.Busy, 0);
+    }
+}
+
+/****************************Internal*Routine******************************\
+ * BltCopyRect
+ *
+ *
+ * Copies a single rect with the given kernel. Large rects are copied in
+ * parallel by BltCopyBands.
+ *
+\**************************************************************************/
+static VOID BltCopyRect(BLT_INFO *pDst, CONST BLT_INFO *pSrc, _In_ CONST RECT *pRect, BLT_FUNCTION *pfnBlt) {
+    LONG Rows = pRect->bottom - pRect->top;
+    SIZE_T Bytes = (SIZE_T)(pRect->right - pRect->left) * Rows * (pSrc->BitsPerPel / BITS_PER_BYTE);
+
+    if (Bytes < BLT_PARALLEL_MIN_BYTES) {
+        pfnBlt(pDst, pSrc, 1, pRect);
+        return;
+    }
+    BltCopyBands(pDst, pSrc, pRect, pfnBlt);
+}
+
+// Probes the rows [Top, Bottom) of a user-mode source, raising an exception if they cannot be read
+static VOID BltProbeSource(CONST BLT_INFO *pSrc, LONG Top, LONG Bottom) {
+    if (Bottom > Top) {
+        ProbeForRead(
+            (BYTE *)pSrc->pBits + (LONG_PTR)(Top + pSrc->Offset.y) * pSrc->Pitch,
+            (SIZE_T)(Bottom - Top) * pSrc->Pitch,
+            1);
+    }
+}
+
+/****************************Internal*Routine******************************\
+ * BltPresentRects
+ *
+ *
+ * Copies the destination rects of all the moves of a present, then all of
+ * its dirty rects, with a single kernel choice and a single exception
+ * frame. A user-mode source is probed once for the rows spanned by all the
+ * rects instead of being validated rect by rect. Large rects are copied in
+ * parallel by the band threads. Returns FALSE if the copy faulted or could
+ * not be done, leaving some of the rects not copied.
+ *
+ * Must be called at IRQL <= APC_LEVEL.
+ *
+\**************************************************************************/
+BOOLEAN BltPresentRects(
+    BLT_INFO *pDst,
+    CONST BLT_INFO *pSrc,
+    UINT NumMoves,
+    _In_reads_(NumMoves) CONST D3DKMT_MOVE_RECT *pMoves,
+    UINT NumDirtyRects,
+    _In_reads_(NumDirtyRects) CONST RECT *pDirtyRects) {
+    if (NumMoves == 0 && NumDirtyRects == 0) {
+        return TRUE;
+    }
+
+    BLT_KERNEL_CONTEXT Kernel;
+    if (!BltAcquireKernel(pDst, pSrc, &Kernel)) {
+        return FALSE;
+    }
+
+    BOOLEAN Copied = TRUE;
+    __try {
+        if (pSrc->pBits <= MM_HIGHEST_USER_ADDRESS) {
+            LONG Top = MAXLONG;
+            LONG Bottom = MINLONG;
+            for (UINT i = 0; i < NumMoves; i++) {
+                Top = min(Top, pMoves[i].DestRect.top);
+                Bottom = max(Bottom, pMoves[i].DestRect.bottom);
+            }
+            for (UINT i = 0; i < NumDirtyRects; i++) {
+                Top = min(Top, pDirtyRects[i].top);
+                Bottom = max(Bottom, pDirtyRects[i].bottom);
+            }
+            BltProbeSource(pSrc, Top, Bottom);
+        }
+
+        for (UINT i = 0; i < NumMoves; i++) {
+            BltCopyRect(pDst, pSrc, &pMoves[i].DestRect, Kernel.pfnBlt);
+        }
+
+        for (UINT i = 0; i < NumDirtyRects; i++) {
+            BltCopyRect(pDst, pSrc, &pDirtyRects[i], Kernel.pfnBlt);
+        }
+    }
+#pragma prefast( \
+    suppress : __WARNING_EXCEPTIONEXECUTEHANDLER, \
+    "try/except is only able to protect against user-mode errors and these are the only errors we try to catch here");
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+        BDD_LOG_ERROR(
+            "Either dst (0x%p) or src (0x%p) bits encountered exception during access.",
+            pDst->pBits,
+            pSrc->pBits);
+        Copied = FALSE;
+    }
+
+    BltReleaseKernel(&Kernel);
+    return Copied;
+}
+
+// Row rects of a multi-rect band handed to the kernel per call, kept small as they live on the stack
+#define BLT_BAND_ROW_RECTS 16
+
+/****************************Internal*Routine******************************\
+ * BltPresentBands
+ *
+ *
+ * Copies the rects of a BDD_REGION: the rects are sorted by top then
+ * left, do not overlap, and the rects sharing a top also share a bottom.
+ * A band made of a single rect is copied like BltPresentRects does. The
+ * rects of a wider band are copied row by row, so that the frame buffer
+ * is written in ascending address order and no page is left and written
+ * again later in the present. The row rects are batched through a small
+ * array, so the kernel is called once per BLT_BAND_ROW_RECTS of them
+ * rather than once each. Returns FALSE like BltPresentRects.
+ *
+ * Must be called at IRQL <= APC_LEVEL.
+ *
+\**************************************************************************/
+BOOLEAN BltPresentBands(BLT_INFO *pDst, CONST BLT_INFO *pSrc, UINT NumRects, _In_reads_(NumRects) CONST RECT *pRects) {
+    if (NumRects == 0) {
+        return TRUE;
+    }
+
+    BLT_KERNEL_CONTEXT Kernel;
+    if (!BltAcquireKernel(pDst, pSrc, &Kernel)) {
+        return FALSE;
+    }
+
+    BOOLEAN Copied = TRUE;
+    __try {
+        if (pSrc->pBits <= MM_HIGHEST_USER_ADDRESS) {
+            BltProbeSource(pSrc, pRects[0].top, pRects[NumRects - 1].bottom);
+        }
+
+        UINT i = 0;
+        while (i < NumRects) {
+            UINT BandEnd = i + 1;
+            while (BandEnd < NumRects && pRects[BandEnd].top == pRects[i].top) {
+                BandEnd++;
+            }
+
+            if (BandEnd == i + 1) {
+                BltCopyRect(pDst, pSrc, &pRects[i], Kernel.pfnBlt);
+            } else {
+                RECT Rows[BLT_BAND_ROW_RECTS];
+                UINT NumRows = 0;
+                for (LONG y = pRects[i].top; y < pRects[i].bottom; y++) {
+                    for (UINT j = i; j < BandEnd; j++) {
+                        Rows[NumRows].left = pRects[j].left;
+                        Rows[NumRows].top = y;
+                        Rows[NumRows].right = pRects[j].right;
+                        Rows[NumRows].bottom = y + 1;
+                        if (++NumRows == BLT_BAND_ROW_RECTS) {
+                            Kernel.pfnBlt(pDst, pSrc, NumRows, Rows);
+                            NumRows = 0;
+                        }
+                    }
+                }
+                if (NumRows != 0) {
+                    Kernel.pfnBlt(pDst, pSrc, NumRows, Rows);
+                }
+            }
+
+            i = BandEnd;
+        }
+    }
+#pragma prefast( \
+    suppress : __WARNING_EXCEPTIONEXECUTEHANDLER, \
+    "try/except is only able to protect against user-mode errors and these are the only errors we try to catch here");
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+        BDD_LOG_ERROR(
+            "Either dst (0x%p) or src (0x%p) bits encountered exception during access.",
+            pDst->pBits,
+            pSrc->pBits);
+        Copied = FALSE;
+    }
+
+    BltReleaseKernel(&Kernel);
+    return Copied;
+}
+
+// Unchanged runs shorter than this many pixels are copied rather than splitting a changed span
+#define BLT_DIFF_MIN_GAP 16
+
+// Returns TRUE if the 4 pixels at pA and pB are identical
+static FORCEINLINE BOOLEAN BltPixelsEqual4(CONST ULONG *pA, CONST ULONG *pB) {
+#if defined(_M_AMD64)
+    __m128i Cmp = _mm_cmpeq_epi32(_mm_loadu_si128((CONST __m128i *)pA), _mm_loadu_si128((CONST __m128i *)pB));
+    return _mm_movemask_epi8(Cmp) == 0xffff;
+#elif defined(_M_ARM64)
+    return vminvq_u32(vceqq_u32(vld1q_u32(pA), vld1q_u32(pB))) == 0xffffffff;
+#else
+    return ((pA[0] ^ pB[0]) | (pA[1] ^ pB[1]) | (pA[2] ^ pB[2]) | (pA[3] ^ pB[3])) == 0;
+#endif
+}
+
+// Returns the first pixel of [x, End) that differs between the rows, or End
+static LONG BltFindChange(CONST ULONG *pSrc, CONST ULONG *pShadow, LONG x, LONG End) {
+    for (; x + 4 <= End; x += 4) {
+        if (!BltPixelsEqual4(pSrc + x, pShadow + x)) {
+            break;
+        }
+    }
+    for (; x < End; x++) {
+        if (pSrc[x] != pShadow[x]) {
+            return x;
+        }
+    }
+    return End;
+}
+
+// Returns the end of the changed span starting with the differing pixel x
+static LONG BltFindSpanEnd(CONST ULONG *pSrc, CONST ULONG *pShadow, LONG x, LONG End) {
+    LONG SpanEnd = x + 1;
+    LONG i = SpanEnd;
+    while (i < End && i - SpanEnd < BLT_DIFF_MIN_GAP) {
+        if (i + 4 <= End && BltPixelsEqual4(pSrc + i, pShadow + i)) {
+            i += 4;
+            continue;
+        }
+
+        LONG ChunkEnd = min(i + 4, End);
+        for (; i < ChunkEnd; i++) {
+            if (pSrc[i] != pShadow[i]) {
+                SpanEnd = i + 1;
+            }
+        }
+    }
+    return SpanEnd;
+}
+
+/****************************Internal*Routine******************************\
+ * BltDiffRect
+ *
+ *
+ * Compares a 32bpp source rect against the shadow copy of what the frame
+ * buffer holds, and returns the spans that changed as rects, merging a
+ * span with the one above it when they have the same columns. The changed
+ * spans are copied into the shadow. If MaxSpans is too small, the last
+ * rect covers all the remaining rows.
+ *
+\**************************************************************************/
+UINT BltDiffRect(
+    CONST BLT_INFO *pSrc,
+    BLT_INFO *pShadow,
+    _In_ CONST RECT *pRect,
+    _Out_writes_to_(MaxSpans, return) RECT *pSpans,
+    UINT MaxSpans) {
+    BDD_ASSERT(MaxSpans > 0);
+    BDD_ASSERT(pSrc->BitsPerPel == 32 && pShadow->BitsPerPel == 32);
+
+    UINT NumSpans = 0;
+    LONG y = pRect->top;
+
+    __try {
+        for (; y < pRect->bottom; y++) {
+            CONST ULONG *pSrcRow =
+                (CONST ULONG *)((CONST BYTE *)pSrc->pBits + (LONG_PTR)(y + pSrc->Offset.y) * pSrc->Pitch) +
+                pSrc->Offset.x;
+            ULONG *pShadowRow =
+                (ULONG *)((BYTE *)pShadow->pBits + (LONG_PTR)(y + pShadow->Offset.y) * pShadow->Pitch) +
+                pShadow->Offset.x;
+
+            LONG x = BltFindChange(pSrcRow, pShadowRow, pRect->left, pRect->right);
+            while (x < pRect->right) {
+                LONG SpanEnd = BltFindSpanEnd(pSrcRow, pShadowRow, x, pRect->right);
+                RtlCopyMemory(pShadowRow + x, pSrcRow + x, (SpanEnd - x) * sizeof(ULONG));
+
+                RECT *pLast = (NumSpans != 0) ? &pSpans[NumSpans - 1] : NULL;
+                if (pLast != NULL && pLast->bottom == y && pLast->left == x && pLast->right == SpanEnd) {
+                    pLast->bottom = y + 1;
+                } else if (NumSpans + 1 < MaxSpans) {
+                    pSpans[NumSpans].left = x;
+                    pSpans[NumSpans].top = y;
+                    pSpans[NumSpans].right = SpanEnd;
+                    pSpans[NumSpans].bottom = y + 1;
+                    NumSpans++;
+                } else {
+                    goto Overflow;
+                }
+
+                x = BltFindChange(pSrcRow, pShadowRow, SpanEnd, pRect->right);
+            }
+        }
+        return NumSpans;
+
+    Overflow:
+        // Too fragmented, the rest of the rect is copied whole
+        for (LONG Row = y; Row < pRect->bottom; Row++) {
+            RtlCopyMemory(
+                (ULONG *)((BYTE *)pShadow->pBits + (LONG_PTR)(Row + pShadow->Offset.y) * pShadow->Pitch) +
+                    pShadow->Offset.x + pRect->left,
+                (CONST ULONG *)((CONST BYTE *)pSrc->pBits + (LONG_PTR)(Row + pSrc->Offset.y) * pSrc->Pitch) +
+                    pSrc->Offset.x + pRect->left,
+                (pRect->right - pRect->left) * sizeof(ULONG));
+        }
+    }
+#pragma prefast( \
+    suppress : __WARNING_EXCEPTIONEXECUTEHANDLER, \
+    "try/except is only able to protect against user-mode errors and these are the only errors we try to catch here");
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+        BDD_LOG_ERROR("Source bits (0x%p) encountered exception during comparison.", pSrc->pBits);
+    }
+
+    // Either too fragmented or the source faulted, in which case the copy logs the fault
+    pSpans[NumSpans].left = pRect->left;
+    pSpans[NumSpans].top = y;
+    pSpans[NumSpans].right = pRect->right;
+    pSpans[NumSpans].bottom = pRect->bottom;
+    return NumSpans + 1;
+}
+
+#define BLT_HASH_PRIME1 0x9E3779B185EBCA87ULL
+#define BLT_HASH_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define BLT_HASH_PRIME3 0x165667B19E3779F9ULL
+
+static FORCEINLINE ULONG64 BltHashRound(ULONG64 Acc, ULONG64 Input) {
+    Acc += Input * BLT_HASH_PRIME2;
+    Acc = _rotl64(Acc, 31);
+    return Acc * BLT_HASH_PRIME1;
+}
+
+/****************************Internal*Routine******************************\
+ * BltHashRect
+ *
+ *
+ * Hashes a rect of a 32bpp surface with four independent xxHash64 style
+ * lanes, so that the multiplies of consecutive pixel pairs overlap. The
+ * hash only serves to notice that pixels changed between two presents, a
+ * collision leaves a stale tile on screen until it changes again. Zero is
+ * returned if the source faulted and never otherwise.
+ *
+\**************************************************************************/
+ULONG64 BltHashRect(CONST BLT_INFO *pSrc, _In_ CONST RECT *pRect) {
+    BDD_ASSERT(pSrc->BitsPerPel == 32);
+
+    ULONG64 Lanes[4] = {BLT_HASH_PRIME1 + BLT_HASH_PRIME2, BLT_HASH_PRIME2, 0, 0 - BLT_HASH_PRIME1};
+    LONG Width = pRect->right - pRect->left;
+
+    __try {
+        for (LONG y = pRect->top; y < pRect->bottom; y++) {
+            CONST ULONG *pRow =
+                (CONST ULONG *)((CONST BYTE *)pSrc->pBits + (LONG_PTR)(y + pSrc->Offset.y) * pSrc->Pitch) +
+                pSrc->Offset.x + pRect->left;
+
+            LONG x = 0;
+            for (; x + 8 <= Width; x += 8) {
+                Lanes[0] = BltHashRound(Lanes[0], *(UNALIGNED CONST ULONG64 *)(pRow + x));
+                Lanes[1] = BltHashRound(Lanes[1], *(UNALIGNED CONST ULONG64 *)(pRow + x + 2));
+                Lanes[2] = BltHashRound(Lanes[2], *(UNALIGNED CONST ULONG64 *)(pRow + x + 4));
+                Lanes[3] = BltHashRound(Lanes[3], *(UNALIGNED CONST ULONG64 *)(pRow + x + 6));
+            }
+            for (; x < Width; x++) {
+                Lanes[x & 3] = BltHashRound(Lanes[x & 3], pRow[x]);
+            }
+        }
+    }
+#pragma prefast( \
+    suppress : __WARNING_EXCEPTIONEXECUTEHANDLER, \
+    "try/except is only able to protect against user-mode errors and these are the only errors we try to catch here");
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+        BDD_LOG_ERROR("Source bits (0x%p) encountered exception during hashing.", pSrc->pBits);
+        return 0;
+    }
+
+    ULONG64 Hash = _rotl64(Lanes[0], 1) + _rotl64(Lanes[1], 7) + _rotl64(Lanes[2], 12) + _rotl64(Lanes[3], 18);
+    Hash ^= Hash >> 33;
+    Hash *= BLT_HASH_PRIME2;
+    Hash ^= Hash >> 29;
+    Hash *= BLT_HASH_PRIME3;
+    Hash ^= Hash >> 32;
+
+    // Zero marks a tile whose content is unknown
+    return (Hash != 0) ? Hash : 1;
+}
+
+/****************************Internal*Routine******************************\
+ * BltZeroFrame
+ *
+ *
+ * Zeroes part of the frame buffer. On x64 the zeroes are written with
+ * non-temporal stores, 64 bytes per iteration once the destination is
+ * aligned, so that they go straight to the write-combining buffers without
+ * reading the frame buffer. The stores are ordered before returning.
+ *
+\**************************************************************************/
+VOID BltZeroFrame(_Out_writes_bytes_(Bytes) BYTE *pDst, SIZE_T Bytes) {
+#if defined(_M_AMD64)
+    if (((ULONG_PTR)pDst & 3) != 0 || (Bytes & 3) != 0) {
+        RtlZeroMemory(pDst, Bytes);
+        return;
+    }
+
+    __m128i Zero = _mm_setzero_si128();
+
+    while (Bytes >= 4 && ((ULONG_PTR)pDst & 15) != 0) {
+        _mm_stream_si32((int *)pDst, 0);
+        pDst += 4;
+        Bytes -= 4;
+    }
+
+    while (Bytes >= 64) {
+        _mm_stream_si128((__m128i *)(pDst + 0), Zero);
+        _mm_stream_si128((__m128i *)(pDst + 16), Zero);
+        _mm_stream_si128((__m128i *)(pDst + 32), Zero);
+        _mm_stream_si128((__m128i *)(pDst + 48), Zero);
+        pDst += 64;
+        Bytes -= 64;
+    }
+
+    while (Bytes >= 16) {
+        _mm_stream_si128((__m128i *)pDst, Zero);
+        pDst += 16;
+        Bytes -= 16;
+    }
+
+    while (Bytes >= 4) {
+        _mm_stream_si32((int *)pDst, 0);
+        pDst += 4;
+        Bytes -= 4;
+    }
+
+    BltFlush();
+#else
+    RtlZeroMemory(pDst, Bytes);
+#endif
+}
+
+/****************************Internal*Routine******************************\
+ * BltFlush
+ *
+ *
+ * Orders the non-temporal stores of all the BltBits calls made so far
+ * before any later store. The fence is only needed once per present, not
+ * once per row or rect.
+ *
+\**************************************************************************/
+VOID BltFlush(VOID) {
+#if defined(_M_AMD64)
+    _mm_sfence();
+#else
+    KeMemoryBarrier();
+#endif
+}
+
+// END: Non-Paged Code
+#pragma code_seg(pop)
+
+#pragma code_seg("PAGE")
+
+// Picks the default kernel for every row class before (or without) calibration
+static VOID BltSelectDefaultRowKernels(VOID) {
+    PAGED_CODE();
+
+    UCHAR Default = 0;
+    for (UCHAR i = 0; i < ARRAYSIZE(BltRowKernels); i++) {
+        // The table goes from the most generic kernel to the most specialized one, take the last supported one that
+        // doesn't need the extended state to be saved
+        if ((BltRowKernels[i].CpuFeatures & ~BltCpuFeatures) == 0 &&
+            (BltRowKernels[i].CpuFeatures & BLT_CPU_AVX) == 0) {
+            Default = i;
+        }
+    }
+
+    for (UINT Class = 0; Class < BLT_ROW_CLASS_COUNT; Class++) {
+        BltRowKernelForClass[Class] = Default;
+        BltRowKernelForClassNoAvx[Class] = Default;
+    }
+    BltRowKernelsUseAvx = FALSE;
+}
+
+static KSTART_ROUTINE BltBandThread;
+
+static VOID BltBandThread(_In_ PVOID StartContext) {
+    PAGED_CODE();
+
+    BLT_BAND_THREAD *pThread = reinterpret_cast<BLT_BAND_THREAD *>(StartContext);
+
+    // The present worker waits on the bands, so they run at its priority
+    KeSetPriorityThread(KeGetCurrentThread(), BDD_PRESENT_THREAD_PRIORITY);
+
+    for (;;) {
+        KeWaitForSingleObject(&pThread->StartEvent, Executive, KernelMode, FALSE, NULL);
+        if (BltBandPool.Stop) {
+            break;
+        }
+
+        if (BltBandPool.Process != NULL) {
+            KAPC_STATE ApcState;
+            KeStackAttachProcess(BltBandPool.Process, &ApcState);
+            BltBits(BltBandPool.pDst, BltBandPool.pSrc, 1, &pThread->Band);
+            KeUnstackDetachProcess(&ApcState);
+        } else {
+            BltBits(BltBandPool.pDst, BltBandPool.pSrc, 1, &pThread->Band);
+        }
+
+        // The non-temporal stores of this processor must be done before the present is completed
+        BltFlush();
+
+        if (InterlockedDecrement(&BltBandPool.Pending) == 0) {
+            KeSetEvent(&BltBandPool.DoneEvent, IO_NO_INCREMENT, FALSE);
+        }
+    }
+
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+// Starts band threads on at most half of the additional processors, up to BLT_MAX_BAND_THREADS, so a large copy
+// always leaves processors to the rest of the system
+static VOID BltStartBandThreads(VOID) {
+    PAGED_CODE();
+
+    ULONG NumProcessors = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    ULONG NumThreads = min((NumProcessors - 1) / 2, BLT_MAX_BAND_THREADS);
+
+    KeInitializeEvent(&BltBandPool.DoneEvent, NotificationEvent, FALSE);
+
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    InitializeObjectAttributes(&ObjectAttributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
+
+    for (ULONG i = 0; i < NumThreads; i++) {
+        BLT_BAND_THREAD *pThread = &BltBandPool.Threads[i];
+        KeInitializeEvent(&pThread->StartEvent, SynchronizationEvent, FALSE);
+
+        HANDLE hThread;
+        NTSTATUS Status =
+            PsCreateSystemThread(&hThread, THREAD_ALL_ACCESS, &ObjectAttributes, NULL, NULL, BltBandThread, pThread);
+        if (!NT_SUCCESS(Status)) {
+            BDD_LOG_WARNING("PsCreateSystemThread failed with status 0x%x", Status);
+            break;
+        }
+
+        Status = ObReferenceObjectByHandle(
+            hThread,
+            THREAD_ALL_ACCESS,
+            *PsThreadType,
+            KernelMode,
+            (PVOID *)&pThread->pThread,
+            NULL);
+        if (!NT_SUCCESS(Status)) {
+            // Cannot happen with a kernel handle to a thread that was just created
+            BDD_LOG_ASSERTION("ObReferenceObjectByHandle failed with status 0x%x", Status);
+            BltBandPool.Stop = TRUE;
+            KeSetEvent(&pThread->StartEvent, IO_NO_INCREMENT, FALSE);
+            ZwWaitForSingleObject(hThread, FALSE, NULL);
+            BltBandPool.Stop = FALSE;
+            ZwClose(hThread);
+            break;
+        }
+        ZwClose(hThread);
+
+        BltBandPool.NumThreads++;
+    }
+
+    BDD_LOG_INFO("Blt using %lu band threads", BltBandPool.NumThreads);
+}
+
+VOID BltInitialize(VOID) {
+    PAGED_CODE();
+
+    ULONG Features = 0;
+
+#if defined(_M_AMD64)
+    int CpuInfo[4];
+
+    // SSE2 is part of x64
+    Features |= BLT_CPU_SSE2;
+
+    __cpuid(CpuInfo, 0);
+    int MaxLeaf = CpuInfo[0];
+
+    __cpuid(CpuInfo, 1);
+    // OSXSAVE and AVX, plus the OS actually enabling the YMM state
+    if ((CpuInfo[2] & (1 << 27)) && (CpuInfo[2] & (1 << 28)) &&
+        (RtlGetEnabledExtendedFeatures(XSTATE_MASK_AVX) & XSTATE_MASK_AVX) != 0) {
+        Features |= BLT_CPU_AVX;
+    }
+
+    if (MaxLeaf >= 7) {
+        __cpuidex(CpuInfo, 7, 0);
+        if (CpuInfo[1] & (1 << 9)) {
+            Features |= BLT_CPU_ERMS;
+        }
+    }
+#elif defined(_M_ARM64)
+    // Advanced SIMD is mandatory on ARMv8
+    Features |= BLT_CPU_NEON;
+#endif
+
+    BltCpuFeatures = Features;
+    BDD_LOG_INFO("Blt CPU features 0x%lx", BltCpuFeatures);
+
+    BltSelectDefaultRowKernels();
+
+    if (BltBandPool.NumThreads == 0) {
+        BltStartBandThreads();
+    }
+}
+
+VOID BltUninitialize(VOID) {
+    PAGED_CODE();
+
+    BltBandPool.Stop = TRUE;
+    for (ULONG i = 0; i < BltBandPool.NumThreads; i++) {
+        KeSetEvent(&BltBandPool.Threads[i].StartEvent, IO_NO_INCREMENT, FALSE);
+        KeWaitForSingleObject(BltBandPool.Threads[i].pThread, Executive, KernelMode, FALSE, NULL);
+        ObDereferenceObject(BltBandPool.Threads[i].pThread);
+        BltBandPool.Threads[i].pThread = NULL;
+    }
+    BltBandPool.NumThreads = 0;
+    BltBandPool.Stop = FALSE;
+}
+
+#define BLT_CALIBRATION_PITCH 8192
+#define BLT_CALIBRATION_RUNS 3
+
+// Rects copied by each cost model measurement
+#define BLT_COST_SAMPLES 256
+
+// Costs used until BltCalibrate measures them, in the range of what the usual hosts give. A calibration fills the
+// model that is not published and publishes it with a single pointer exchange, as presents read it meanwhile.
+static BLT_COST_MODEL BltCostModels[2] = {{100000, 200000, 250000, 250000, BLT_PARALLEL_MIN_BYTES}};
+static BLT_COST_MODEL *volatile BltCostModel = &BltCostModels[0];
+
+VOID BltGetCostModel(_Out_ BLT_COST_MODEL *pModel) {
+    PAGED_CODE();
+
+    *pModel = *BltCostModel;
+}
+
+// Returns the best time of BLT_CALIBRATION_RUNS copies of the rects with BltBits, in ticks
+static LONGLONG
+BltTimeRects(BLT_INFO *pDst, CONST BLT_INFO *pSrc, UINT NumRects, _In_reads_(NumRects) CONST RECT *pRects) {
+    PAGED_CODE();
+
+    LONGLONG Ticks = MAXLONGLONG;
+    for (UINT Run = 0; Run < BLT_CALIBRATION_RUNS; Run++) {
+        LARGE_INTEGER Start = KeQueryPerformanceCounter(NULL);
+        BltBits(pDst, pSrc, NumRects, pRects);
+        BltFlush();
+        LARGE_INTEGER End = KeQueryPerformanceCounter(NULL);
+        Ticks = min(Ticks, End.QuadPart - Start.QuadPart);
+    }
+    return Ticks;
+}
+
+// Returns the best time of BLT_CALIBRATION_RUNS copies of the rect split in bands like large present rects, in ticks
+static LONGLONG BltTimeBands(BLT_INFO *pDst, CONST BLT_INFO *pSrc, _In_ CONST RECT *pRect) {
+    PAGED_CODE();
+
+    BLT_KERNEL_CONTEXT Kernel;
+    if (!BltAcquireKernel(pDst, pSrc, &Kernel)) {
+        return MAXLONGLONG;
+    }
+
+    LONGLONG Ticks = MAXLONGLONG;
+    for (UINT Run = 0; Run < BLT_CALIBRATION_RUNS; Run++) {
+        LARGE_INTEGER Start = KeQueryPerformanceCounter(NULL);
+        BltCopyBands(pDst, pSrc, pRect, Kernel.pfnBlt);
+        BltFlush();
+        LARGE_INTEGER End = KeQueryPerformanceCounter(NULL);
+        Ticks = min(Ticks, End.QuadPart - Start.QuadPart);
+    }
+
+    BltReleaseKernel(&Kernel);
+    return Ticks;
+}
+
+/****************************Internal*Routine******************************\
+ * BltCalibrateCostModel
+ *
+ *
+ * Measures the coefficients of the rect cost model with the selected
+ * kernels: single pixel rects in one page give the fixed cost of a rect,
+ * single pixel rects in distinct pages add the cost of touching a page,
+ * and one rect over the whole scratch area gives the cost of the bytes.
+ * The same rect split in bands by the band threads gives the cost of the
+ * bytes of the rects presents copy in parallel.
+ *
+\**************************************************************************/
+static VOID BltCalibrateCostModel(_Out_writes_bytes_(BLT_CALIBRATION_SIZE) BYTE *pScratch, CONST BYTE *pSource) {
+    PAGED_CODE();
+
+    RECT *pRects = new (PagedPool) RECT[BLT_COST_SAMPLES];
+    if (pRects == NULL) {
+        BDD_LOG_WARNING("Failed to allocate the blt cost model rects");
+        return;
+    }
+
+    BLT_INFO Dst;
+    Dst.pBits = pScratch;
+    Dst.Pitch = BLT_CALIBRATION_PITCH;
+    Dst.BitsPerPel = 32;
+    Dst.Offset.x = 0;
+    Dst.Offset.y = 0;
+    Dst.Rotation = D3DKMDT_VPPR_IDENTITY;
+    Dst.Width = BLT_CALIBRATION_PITCH / sizeof(ULONG);
+    Dst.Height = BLT_CALIBRATION_SIZE / BLT_CALIBRATION_PITCH;
+
+    BLT_INFO Src = Dst;
+    Src.pBits = (VOID *)pSource;
+
+    for (UINT i = 0; i < BLT_COST_SAMPLES; i++) {
+        pRects[i].left = i;
+        pRects[i].top = 0;
+        pRects[i].right = i + 1;
+        pRects[i].bottom = 1;
+    }
+    LONGLONG RectTicks = BltTimeRects(&Dst, &Src, BLT_COST_SAMPLES, pRects);
+
+    // One pixel at the start of every page of the scratch area
+    Dst.Pitch = Src.Pitch = PAGE_SIZE;
+    Dst.Width = Src.Width = PAGE_SIZE / sizeof(ULONG);
+    Dst.Height = Src.Height = BLT_CALIBRATION_SIZE / PAGE_SIZE;
+    for (UINT i = 0; i < BLT_COST_SAMPLES; i++) {
+        pRects[i].left = 0;
+        pRects[i].top = i;
+        pRects[i].right = 1;
+        pRects[i].bottom = i + 1;
+    }
+    LONGLONG PageTicks = BltTimeRects(&Dst, &Src, BLT_COST_SAMPLES, pRects);
+
+    RECT All = {0, 0, (LONG)Dst.Width, (LONG)Dst.Height};
+    LONGLONG AllTicks = BltTimeRects(&Dst, &Src, 1, &All);
+    LONGLONG BandTicks = (BltBandPool.NumThreads != 0) ? BltTimeBands(&Dst, &Src, &All) : AllTicks;
+
+    delete[] pRects;
+
+    LARGE_INTEGER Frequency;
+    KeQueryPerformanceCounter(&Frequency);
+    LONGLONG PicosecondsPerTick = 1000000000000LL / Frequency.QuadPart;
+
+    LONGLONG RectCost = RectTicks * PicosecondsPerTick / BLT_COST_SAMPLES;
+    LONGLONG PageCost = max(PageTicks - RectTicks, 0) * PicosecondsPerTick / BLT_COST_SAMPLES;
+    LONGLONG BytesCost = AllTicks * PicosecondsPerTick - RectCost - PageCost * (BLT_CALIBRATION_SIZE / PAGE_SIZE);
+    LONGLONG BandBytesCost =
+        min(BandTicks, AllTicks) * PicosecondsPerTick - RectCost - PageCost * (BLT_CALIBRATION_SIZE / PAGE_SIZE);
+
+    BLT_COST_MODEL *pModel = (BltCostModel == &BltCostModels[0]) ? &BltCostModels[1] : &BltCostModels[0];
+    pModel->RectCost = (ULONG)min(RectCost, MAXULONG);
+    pModel->PageCost = (ULONG)min(PageCost, MAXULONG);
+    pModel->KiBCost = (ULONG)min(max(BytesCost / (BLT_CALIBRATION_SIZE / 1024), 1), MAXULONG);
+    pModel->BandKiBCost = (ULONG)min(max(BandBytesCost / (BLT_CALIBRATION_SIZE / 1024), 1), MAXULONG);
+    pModel->BandMinBytes = (BltBandPool.NumThreads != 0) ? BLT_PARALLEL_MIN_BYTES : MAXULONG;
+    InterlockedExchangePointer((PVOID volatile *)&BltCostModel, pModel);
+
+    BDD_LOG_INFO(
+        "Blt cost model: %lu ps per rect, %lu ps per page, %lu ps per KiB, %lu ps per KiB in bands",
+        pModel->RectCost,
+        pModel->PageCost,
+        pModel->KiBCost,
+        pModel->BandKiBCost);
+}
+
+/****************************Internal*Routine******************************\
+ * BltCalibrate
+ *
+ *
+ * Times every row kernel supported by the processor for each row class,
+ * writing into Size bytes of the real framebuffer mapping at pScratch
+ * (which must not be visible), and selects the fastest one per class. The
+ * cost model of rect copies is then measured with the selected kernels.
+ * The scratch area is left zeroed.
+ *
+\**************************************************************************/
+VOID BltCalibrate(_Out_writes_bytes_(Size) BYTE *pScratch, SIZE_T Size) {
+    PAGED_CODE();
+
+    static CONST SIZE_T RowBytes[BLT_ROW_CLASS_COUNT] = {64, 1024, 7680};
+
+    if (Size < BLT_CALIBRATION_SIZE) {
+        BDD_LOG_WARNING(
+            "Blt calibration needs 0x%x bytes of scratch framebuffer, got 0x%zx",
+            BLT_CALIBRATION_SIZE,
+            Size);
+        return;
+    }
+
+    BYTE *pSource = new (NonPagedPoolNx) BYTE[BLT_CALIBRATION_SIZE];
+    if (pSource == NULL) {
+        BDD_LOG_WARNING("Failed to allocate the blt calibration source");
+        return;
+    }
+    for (SIZE_T i = 0; i < BLT_CALIBRATION_SIZE; i++) {
+        pSource[i] = (BYTE)(i * 7);
+    }
+
+#if defined(_M_AMD64)
+    XSTATE_SAVE XStateSave;
+    BOOLEAN AvxSaved = (BltCpuFeatures & BLT_CPU_AVX) != 0 &&
+        NT_SUCCESS(KeSaveExtendedProcessorState(XSTATE_MASK_AVX, &XStateSave));
+#else
+    BOOLEAN AvxSaved = FALSE;
+#endif
+
+    for (UINT Class = 0; Class < BLT_ROW_CLASS_COUNT; Class++) {
+        LONGLONG BestTicks = MAXLONGLONG;
+        LONGLONG BestTicksNoAvx = MAXLONGLONG;
+
+        for (UCHAR Kernel = 0; Kernel < ARRAYSIZE(BltRowKernels); Kernel++) {
+            ULONG Needed = BltRowKernels[Kernel].CpuFeatures;
+            if ((Needed & ~BltCpuFeatures) != 0 || ((Needed & BLT_CPU_AVX) && !AvxSaved)) {
+                continue;
+            }
+
+            LONGLONG Ticks = MAXLONGLONG;
+            for (UINT Run = 0; Run < BLT_CALIBRATION_RUNS; Run++) {
+                LARGE_INTEGER Start = KeQueryPerformanceCounter(NULL);
+                for (SIZE_T Offset = 0; Offset < BLT_CALIBRATION_SIZE; Offset += BLT_CALIBRATION_PITCH) {
+                    BltRowKernels[Kernel].pfnCopyRow(pScratch + Offset, pSource + Offset, RowBytes[Class]);
+                }
+                BltFlush();
+                LARGE_INTEGER End = KeQueryPerformanceCounter(NULL);
+                Ticks = min(Ticks, End.QuadPart - Start.QuadPart);
+            }
+
+            BDD_LOG_TRACE(
+                "Blt calibration: %s rows with %s took %lld ticks",
+                BltRowClassNames[Class],
+                BltRowKernels[Kernel].Name,
+                Ticks);
+
+            if (Ticks < BestTicks) {
+                BestTicks = Ticks;
+                BltRowKernelForClass[Class] = Kernel;
+            }
+            if ((Needed & BLT_CPU_AVX) == 0 && Ticks < BestTicksNoAvx) {
+                BestTicksNoAvx = Ticks;
+                BltRowKernelForClassNoAvx[Class] = Kernel;
+            }
+        }
+    }
+
+#if defined(_M_AMD64)
+    if (AvxSaved) {
+        KeRestoreExtendedProcessorState(&XStateSave);
+    }
+#endif
+
+    BltRowKernelsUseAvx = FALSE;
+    for (UINT Class = 0; Class < BLT_ROW_CLASS_COUNT; Class++) {
+        if (BltRowKernels[BltRowKernelForClass[Class]].CpuFeatures & BLT_CPU_AVX) {
+            BltRowKernelsUseAvx = TRUE;
+        }
+        BDD_LOG_INFO(
+            "Blt kernel for %s rows: %s (%s without AVX state)",
+            BltRowClassNames[Class],
+            BltRowKernels[BltRowKernelForClass[Class]].Name,
+            BltRowKernels[BltRowKernelForClassNoAvx[Class]].Name);
+    }
+
+    BltCalibrateCostModel(pScratch, pSource);
+
+    RtlZeroMemory(pScratch, BLT_CALIBRATION_SIZE);
+    delete[] pSource;
+}
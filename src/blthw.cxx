@@ -2,111 +2,2541 @@
 
 // Based on the Microsoft KMDOD example
 // Copyright (c) 2010 Microsoft Corporation
+// Copyright 2026 Vates.
 
 #include "bdd.hxx"
 
 #pragma code_seg("PAGE")
 
-typedef struct _DO_PRESENT_MEMORY {
-    PVOID DstAddr;
-    UINT DstStride;
-    ULONG DstBitPerPixel;
-    UINT SrcWidth;
-    UINT SrcHeight;
-    BYTE *SrcAddr;
-    LONG SrcPitch;
-    ULONG NumMoves;          // in:  Number of screen to screen moves
-    D3DKMT_MOVE_RECT *Moves; // in:  Point to the list of moves
-    ULONG NumDirtyRects;     // in:  Number of direct rects
-    RECT *DirtyRect;         // in:  Point to the list of dirty rects
-    D3DKMDT_VIDPN_PRESENT_PATH_ROTATION Rotation;
-    D3DDDI_VIDEO_PRESENT_SOURCE_ID SourceID;
-    HANDLE hAdapter;
-    BDD_HWBLT *DisplaySource;
-} DO_PRESENT_MEMORY, *PDO_PRESENT_MEMORY;
+// Sources with a source mapping cache, protected by gBddSourcesLock
+static LIST_ENTRY gBddSources;
+static FAST_MUTEX gBddSourcesLock;
 
-static void HwExecutePresentDisplayOnly(PDO_PRESENT_MEMORY Context)
+// Without the process notification the mappings of exiting processes could not be unlocked, so nothing is cached
+static BOOLEAN gBddSourceCacheEnabled;
+
+static NTSTATUS LockPresentSource(_In_ BYTE *SrcAddr, SIZE_T Size, _Out_ PMDL *pMdl, _Out_ BYTE **pSystemAddr)
+/*++
+
+  Routine Description:
+
+    The routine locks the pages of the source surface and maps them into
+    system space, so they can be read by any thread without faulting
+
+  Arguments:
+
+    SrcAddr - address of source surface in the current process
+    Size - size of source surface in bytes
+    pMdl - receives the MDL to pass to UnlockPresentSource
+    pSystemAddr - receives the system space address of the source surface
+
+  Return Value:
+
+    Status
+
+--*/
+{
+    PAGED_CODE();
+
+    *pMdl = NULL;
+    *pSystemAddr = NULL;
+
+    PMDL Mdl = IoAllocateMdl(SrcAddr, (ULONG)Size, FALSE, FALSE, NULL);
+    if (!Mdl) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    __try {
+        MmProbeAndLockPages(Mdl, (SrcAddr <= MM_HIGHEST_USER_ADDRESS) ? UserMode : KernelMode, IoReadAccess);
+    }
+#pragma prefast( \
+    suppress : __WARNING_EXCEPTIONEXECUTEHANDLER, \
+    "try/except is only able to protect against user-mode errors and these are the only errors we try to catch here");
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+        NTSTATUS Status = GetExceptionCode();
+        IoFreeMdl(Mdl);
+        return Status;
+    }
+
+    BYTE *SystemAddr = (BYTE *)MmGetSystemAddressForMdlSafe(Mdl, HighPagePriority | MdlMappingNoExecute);
+    if (!SystemAddr) {
+        MmUnlockPages(Mdl);
+        IoFreeMdl(Mdl);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    *pMdl = Mdl;
+    *pSystemAddr = SystemAddr;
+    return STATUS_SUCCESS;
+}
+
+static BOOLEAN IsPresentSourceMapped(_In_ BYTE *SrcAddr, SIZE_T Size, _In_ PMDL Mdl)
+/*++
+
+  Routine Description:
+
+    The routine checks that the locked pages of a source surface are still
+    the ones mapped at its address. A surface freed by its process and
+    another one allocated at the same address are mapped to new pages, and
+    a smaller surface may keep some of the old pages, so every page is
+    compared.
+
+  Arguments:
+
+    SrcAddr - address of source surface in the current process
+    Size - size of source surface in bytes
+    Mdl - MDL locking the pages of the source surface
+
+  Return Value:
+
+    TRUE if all the pages of the surface are still mapped
+
+--*/
+{
+    PAGED_CODE();
+
+    PPFN_NUMBER Pfns = MmGetMdlPfnArray(Mdl);
+    ULONG NumPages = ADDRESS_AND_SIZE_TO_SPAN_PAGES(SrcAddr, Size);
+    BYTE *PageAddr = (BYTE *)PAGE_ALIGN(SrcAddr);
+
+    // Returns 0 for a page that is not resident, which a locked page cannot be
+    for (ULONG i = 0; i < NumPages; i++, PageAddr += PAGE_SIZE) {
+        if ((PFN_NUMBER)(MmGetPhysicalAddress(PageAddr).QuadPart >> PAGE_SHIFT) != Pfns[i]) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static VOID UnlockPresentSource(_In_ PMDL Mdl) {
+    PAGED_CODE();
+
+    // Unlocking also releases the system space mapping
+    MmUnlockPages(Mdl);
+    IoFreeMdl(Mdl);
+}
+
+// Number of pixels covered by rects that do not overlap
+static LONGLONG CountPixels(UINT NumRects, _In_reads_(NumRects) CONST RECT *pRects) {
+    LONGLONG Pixels = 0;
+    for (UINT i = 0; i < NumRects; i++) {
+        Pixels += (LONGLONG)(pRects[i].right - pRects[i].left) * (pRects[i].bottom - pRects[i].top);
+    }
+    return Pixels;
+}
+
+VOID BDD_HWBLT::HwExecutePresentDisplayOnly(_Inout_ PDO_PRESENT_MEMORY Context)
+/*++
+
+  Routine Description:
+
+    The routine executes present's commands and report progress to the OS
+
+  Arguments:
+
+    Context - Context with present's command
+
+  Return Value:
+
+    None
+
+--*/
+{
+    PAGED_CODE();
+
+    // Set up destination blt info, double buffered presents are drawn into the back frame and scroll panned ones
+    // into the visible frame wherever it starts
+    BLT_INFO DstBltInfo;
+    DstBltInfo.pBits = reinterpret_cast<BYTE *>(Context->DstAddr) + (SIZE_T)m_BackFrame * Context->DstFrameSize +
+        (SIZE_T)m_PanRow * Context->DstStride;
+    DstBltInfo.Pitch = Context->DstStride;
+    DstBltInfo.BitsPerPel = Context->DstBitPerPixel;
+    DstBltInfo.Offset.x = 0;
+    DstBltInfo.Offset.y = 0;
+    DstBltInfo.Rotation = Context->Rotation;
+    DstBltInfo.Width = Context->SrcWidth;
+    DstBltInfo.Height = Context->SrcHeight;
+
+    // Set up source blt info
+    BLT_INFO SrcBltInfo;
+    SrcBltInfo.pBits = Context->SrcAddr;
+    SrcBltInfo.Pitch = Context->SrcPitch;
+    SrcBltInfo.BitsPerPel = 32;
+    SrcBltInfo.Offset.x = 0;
+    SrcBltInfo.Offset.y = 0;
+    SrcBltInfo.Rotation = D3DKMDT_VPPR_IDENTITY;
+    if (Context->Rotation == D3DKMDT_VPPR_ROTATE90 || Context->Rotation == D3DKMDT_VPPR_ROTATE270) {
+        SrcBltInfo.Width = DstBltInfo.Height;
+        SrcBltInfo.Height = DstBltInfo.Width;
+    } else {
+        SrcBltInfo.Width = DstBltInfo.Width;
+        SrcBltInfo.Height = DstBltInfo.Height;
+    }
+
+    LARGE_INTEGER Start = KeQueryPerformanceCounter(NULL);
+
+    if (Context->DstPanRows != 0 && PanPresent(Context, &DstBltInfo, &SrcBltInfo)) {
+        m_Stats.CopyTicks += KeQueryPerformanceCounter(NULL).QuadPart - Start.QuadPart;
+        return;
+    }
+
+    // A NULL list of rects stands for the moves and dirty rects of the present
+    CONST RECT *pRects;
+    UINT NumRects;
+    if (!DetectChanges(Context, &SrcBltInfo, &pRects, &NumRects)) {
+        pRects = NULL;
+        NumRects = Context->NumMoves + Context->NumDirtyRects;
+    }
+
+    LARGE_INTEGER Detected = KeQueryPerformanceCounter(NULL);
+
+    MergePresentRects(Context, &DstBltInfo, &SrcBltInfo, &pRects, &NumRects);
+
+    // The adaptive policy measures the copy against what was written, which flips and bands make differ from the rects
+    CONST RECT *pBands;
+    UINT NumBands;
+    LONGLONG PixelsWritten = (pRects != NULL) ? CountPixels(NumRects, pRects) : 0;
+    BOOLEAN Copied = TRUE;
+    if (Context->DstFrameSize != 0) {
+        if (NumRects != 0) {
+            PixelsWritten = FlipPresent(Context, &DstBltInfo, &SrcBltInfo, pRects, NumRects);
+        }
+    } else if (SchedulePresent(Context, &SrcBltInfo, pRects, NumRects, &pBands, &NumBands)) {
+        Copied = BltPresentBands(&DstBltInfo, &SrcBltInfo, NumBands, pBands);
+        PixelsWritten = CountPixels(NumBands, pBands);
+        if (Context->Rotation == D3DKMDT_VPPR_IDENTITY) {
+            m_Stats.ScheduledPresents++;
+            m_Stats.PagesWritten += CountPagesWritten(&DstBltInfo, NumBands, pBands);
+        }
+    } else if (pRects != NULL) {
+        Copied = BltPresentRects(&DstBltInfo, &SrcBltInfo, 0, NULL, NumRects, pRects);
+    } else {
+        // Copy all the scroll rects, then all the dirty rects from source image to video frame buffer.
+        Copied = BltPresentRects(
+            &DstBltInfo,
+            &SrcBltInfo,
+            Context->NumMoves,
+            Context->Moves,
+            Context->NumDirtyRects,
+            Context->DirtyRect);
+    }
+    BltFlush();
+
+    if (!Copied) {
+        InvalidatePresentRects(Context, &SrcBltInfo);
+    }
+
+    LARGE_INTEGER End = KeQueryPerformanceCounter(NULL);
+    if (pRects != NULL) {
+        MeasureCopyCost(PixelsWritten, End.QuadPart - Detected.QuadPart);
+    }
+    m_Stats.CopyTicks += End.QuadPart - Start.QuadPart;
+}
+
+LONGLONG BDD_HWBLT::FlipPresent(
+    _In_ PDO_PRESENT_MEMORY Context,
+    CONST BLT_INFO *pDst,
+    CONST BLT_INFO *pSrc,
+    _In_reads_opt_(NumRects) CONST RECT *pRects,
+    UINT NumRects)
+/*++
+
+  Routine Description:
+
+    The method draws a present into the back frame and flips it to the
+    front. The back frame was last drawn two presents ago, so it also gets
+    the damage of the previous present, which only went to the other frame.
+    A frame whose content is unknown is copied whole, as is a frame whose
+    copy faulted the next time it is drawn.
+
+  Arguments:
+
+    Context - present being executed
+    pDst - back frame of the frame buffer
+    pSrc - source of the present
+    pRects - rects of the present, or NULL for its moves and dirty rects
+    NumRects - number of rects of the present
+
+  Return Value:
+
+    Number of pixels written to the back frame
+
+--*/
+{
+    PAGED_CODE();
+
+    CONST RECT *pBands;
+    UINT NumBands;
+    LONGLONG PixelsWritten;
+    BOOLEAN Copied;
+    BOOLEAN Scheduled = SchedulePresent(Context, pSrc, pRects, NumRects, &pBands, &NumBands);
+    if (Scheduled && !m_FrameStale[m_BackFrame] && NT_SUCCESS(m_FlipDamage.Union(&m_PresentRegion))) {
+        Copied = BltPresentBands(pDst, pSrc, m_FlipDamage.GetNumRects(), m_FlipDamage.GetRects());
+        PixelsWritten = CountPixels(m_FlipDamage.GetNumRects(), m_FlipDamage.GetRects());
+    } else {
+        RECT Full = {0, 0, (LONG)pSrc->Width, (LONG)pSrc->Height};
+        Copied = BltPresentRects(pDst, pSrc, 0, NULL, 1, &Full);
+        PixelsWritten = (LONGLONG)pSrc->Width * pSrc->Height;
+    }
+    BltFlush();
+
+    m_DevExt->FlipFrameBuffer(m_SourceId, m_BackFrame);
+
+    // The damage of the previous present may be missing from a frame whose copy faulted, not only this present's
+    if (!Copied) {
+        InvalidatePresentRects(Context, pSrc);
+    }
+
+    // Without a region the damage of this present is unknown, so the next back frame is copied whole
+    m_FrameStale[m_BackFrame] = !Copied;
+    if (!Scheduled) {
+        m_FrameStale[m_BackFrame ^ 1] = TRUE;
+    }
+
+    m_FlipDamage.Swap(&m_PresentRegion);
+    m_BackFrame ^= 1;
+    return PixelsWritten;
+}
+
+VOID BDD_HWBLT::ResetFlip() {
+    PAGED_CODE();
+
+    m_BackFrame = 1;
+    m_FrameStale[0] = TRUE;
+    m_FrameStale[1] = TRUE;
+    m_FlipDamage.SetEmpty();
+    m_PanRow = 0;
+}
+
+VOID BDD_HWBLT::AllocateChangeDetection(BDD_CHANGE_DETECTION Mode, _In_ CONST CURRENT_BDD_MODE *pMode) {
+    PAGED_CODE();
+
+    FreeChangeDetection();
+
+    m_ChangeDetection = Mode;
+    m_ChangeDetectionRotation = pMode->Rotation;
+
+    if (Mode == BDD_CHANGE_DETECTION_SHADOW || Mode == BDD_CHANGE_DETECTION_ADAPTIVE) {
+        // The shadow holds the unrotated source, whose pitch depends on the rotation but not its size
+        SIZE_T Size = (SIZE_T)pMode->SrcModeWidth * pMode->SrcModeHeight * sizeof(ULONG);
+        m_pShadow = new (PagedPool) BYTE[Size];
+        if (!m_pShadow) {
+            BDD_LOG_WARNING("Allocating a 0x%zx bytes shadow frame buffer failed, presents are not compared", Size);
+            return;
+        }
+        m_ShadowSize = Size;
+    } else if (Mode == BDD_CHANGE_DETECTION_TILE_HASH) {
+        // The number of tiles does not depend on the rotation either
+        UINT NumTiles = ((pMode->SrcModeWidth + BDD_TILE_SIZE - 1) / BDD_TILE_SIZE) *
+            ((pMode->SrcModeHeight + BDD_TILE_SIZE - 1) / BDD_TILE_SIZE);
+        m_pTileHashes = new (PagedPool) ULONG64[NumTiles];
+        if (!m_pTileHashes) {
+            BDD_LOG_WARNING("Allocating %u tile hashes failed, presents are not compared", NumTiles);
+            return;
+        }
+        m_NumTiles = NumTiles;
+    }
+
+    if (Mode == BDD_CHANGE_DETECTION_ADAPTIVE) {
+        UINT NumTiles = ((pMode->SrcModeWidth + BDD_TILE_SIZE - 1) / BDD_TILE_SIZE) *
+            ((pMode->SrcModeHeight + BDD_TILE_SIZE - 1) / BDD_TILE_SIZE);
+        m_pTilePolicies = new (PagedPool) BDD_TILE_POLICY[NumTiles];
+        if (!m_pTilePolicies) {
+            BDD_LOG_WARNING("Allocating %u tile policies failed, presents are not compared", NumTiles);
+            return;
+        }
+        RtlZeroMemory(m_pTilePolicies, NumTiles * sizeof(BDD_TILE_POLICY));
+        m_NumTiles = NumTiles;
+
+        // Copying starts from the calibrated cost model, comparing from zero so every tile is compared until the
+        // first present measures it
+        BLT_COST_MODEL Model;
+        BltGetCostModel(&Model);
+        m_CopyCost = Model.KiBCost + Model.PageCost / (PAGE_SIZE / 1024);
+        m_CompareCost = 0;
+
+        LARGE_INTEGER Frequency;
+        KeQueryPerformanceCounter(&Frequency);
+        m_PicosecondsPerTick = 1000000000000LL / Frequency.QuadPart;
+    }
+}
+
+VOID BDD_HWBLT::FreeChangeDetection() {
+    PAGED_CODE();
+
+    delete[] m_pShadow;
+    m_pShadow = NULL;
+    m_ShadowSize = 0;
+    delete[] m_pTileHashes;
+    m_pTileHashes = NULL;
+    delete[] m_pTilePolicies;
+    m_pTilePolicies = NULL;
+    m_NumTiles = 0;
+    m_ChangeDetectionValid = FALSE;
+}
+
+VOID BDD_HWBLT::ResetChangeDetection(BOOLEAN FrameBufferZeroed) {
+    PAGED_CODE();
+
+    // A zero hash never matches, so the tiles are copied again by the next presents that touch them
+    if (m_pTileHashes != NULL) {
+        RtlZeroMemory(m_pTileHashes, m_NumTiles * sizeof(ULONG64));
+    }
+
+    if (m_pShadow != NULL) {
+        m_ChangeDetectionValid = FrameBufferZeroed;
+        if (FrameBufferZeroed) {
+            // A black frame buffer looks the same in any rotation
+            RtlZeroMemory(m_pShadow, m_ShadowSize);
+            m_ChangeDetectionRotation = m_DevExt->GetCurrentMode(m_SourceId)->Rotation;
+        }
+    }
+
+    if (m_pTilePolicies != NULL) {
+        SetTilesStale(!FrameBufferZeroed);
+    }
+
+    // Whatever the frame buffer shows now, it is not the source as of the last present
+    m_DarkOverflow = TRUE;
+}
+
+VOID BDD_HWBLT::SetTilesStale(BOOLEAN Stale) {
+    PAGED_CODE();
+
+    for (UINT i = 0; i < m_NumTiles; i++) {
+        m_pTilePolicies[i].Stale = Stale;
+    }
+}
+
+BOOLEAN BDD_HWBLT::CopyShadowFrame(_Out_ BYTE *pDst, UINT DstBitPerPixel, _In_ CONST CURRENT_BDD_MODE *pMode)
+/*++
+
+  Routine Description:
+
+    The method draws the visible frame of the source from the shadow frame
+    buffer, avoiding a read back of the write-combined frame buffer. Only
+    the shadow of the shadow change detection mode holds the whole source
+    as of the last present, the adaptive one is stale where tiles were
+    copied directly. The worker must be idle.
+
+  Arguments:
+
+    pDst - receives the frame, with the pitch and format of the frame buffer
+    DstBitPerPixel - color depth of the frame buffer
+    pMode - current mode of the source
+
+  Return Value:
+
+    FALSE if the shadow does not hold the visible frame
+
+--*/
+{
+    PAGED_CODE();
+
+    if (m_ChangeDetection != BDD_CHANGE_DETECTION_SHADOW || m_pShadow == NULL || !m_ChangeDetectionValid ||
+        m_ChangeDetectionRotation != pMode->Rotation || pMode->DispInfo.Width != pMode->SrcModeWidth ||
+        pMode->DispInfo.Height != pMode->SrcModeHeight) {
+        return FALSE;
+    }
+
+    BLT_INFO DstBltInfo;
+    DstBltInfo.pBits = pDst;
+    DstBltInfo.Pitch = pMode->DispInfo.Pitch;
+    DstBltInfo.BitsPerPel = DstBitPerPixel;
+    DstBltInfo.Offset.x = 0;
+    DstBltInfo.Offset.y = 0;
+    DstBltInfo.Rotation = pMode->Rotation;
+    DstBltInfo.Width = pMode->SrcModeWidth;
+    DstBltInfo.Height = pMode->SrcModeHeight;
+
+    BLT_INFO ShadowBltInfo;
+    ShadowBltInfo.pBits = m_pShadow;
+    ShadowBltInfo.BitsPerPel = 32;
+    ShadowBltInfo.Offset.x = 0;
+    ShadowBltInfo.Offset.y = 0;
+    ShadowBltInfo.Rotation = D3DKMDT_VPPR_IDENTITY;
+    if (pMode->Rotation == D3DKMDT_VPPR_ROTATE90 || pMode->Rotation == D3DKMDT_VPPR_ROTATE270) {
+        ShadowBltInfo.Width = DstBltInfo.Height;
+        ShadowBltInfo.Height = DstBltInfo.Width;
+    } else {
+        ShadowBltInfo.Width = DstBltInfo.Width;
+        ShadowBltInfo.Height = DstBltInfo.Height;
+    }
+    ShadowBltInfo.Pitch = ShadowBltInfo.Width * sizeof(ULONG);
+
+    RECT Rect = {0, 0, (LONG)ShadowBltInfo.Width, (LONG)ShadowBltInfo.Height};
+    BltBits(&DstBltInfo, &ShadowBltInfo, 1, &Rect);
+    return TRUE;
+}
+
+static BOOLEAN ClipToSource(_Inout_ RECT *pRect, CONST BLT_INFO *pSrc) {
+    pRect->left = max(pRect->left, 0);
+    pRect->top = max(pRect->top, 0);
+    pRect->right = min(pRect->right, (LONG)pSrc->Width);
+    pRect->bottom = min(pRect->bottom, (LONG)pSrc->Height);
+    return pRect->left < pRect->right && pRect->top < pRect->bottom;
+}
+
+// Returns the rect at Index in the moves of the present followed by its dirty rects
+static RECT GetPresentRect(_In_ PDO_PRESENT_MEMORY Context, UINT Index) {
+    return (Index < Context->NumMoves) ? Context->Moves[Index].DestRect
+                                       : Context->DirtyRect[Index - Context->NumMoves];
+}
+
+VOID BDD_HWBLT::InvalidatePresentRects(_In_ PDO_PRESENT_MEMORY Context, CONST BLT_INFO *pSrc)
+/*++
+
+  Routine Description:
+
+    The method forgets what change detection knows of the rects of a
+    present whose copy faulted: the shadow or the hashes were updated with
+    pixels that did not all reach the frame buffer, and would keep them off
+    screen until they change again. The hashes and the stale flags are kept
+    per tile, but the shadow mode has nothing finer than its whole shadow,
+    which is compared against again once a present covers the source.
+
+  Arguments:
+
+    Context - present whose copy faulted
+    pSrc - source of the present
+
+  Return Value:
+
+    None
+
+--*/
+{
+    PAGED_CODE();
+
+    if (m_pShadow != NULL && m_pTilePolicies == NULL) {
+        m_ChangeDetectionValid = FALSE;
+    }
+
+    if (m_pTileHashes == NULL && m_pTilePolicies == NULL) {
+        return;
+    }
+
+    LONG TileColumns = (pSrc->Width + BDD_TILE_SIZE - 1) / BDD_TILE_SIZE;
+    UINT NumInputRects = Context->NumMoves + Context->NumDirtyRects;
+    for (UINT i = 0; i < NumInputRects; i++) {
+        RECT Rect = GetPresentRect(Context, i);
+        if (!ClipToSource(&Rect, pSrc)) {
+            continue;
+        }
+
+        // A zero hash never matches and a stale tile is copied whole, so the next presents copy the tiles again
+        for (LONG TileY = Rect.top / BDD_TILE_SIZE; TileY * BDD_TILE_SIZE < Rect.bottom; TileY++) {
+            for (LONG TileX = Rect.left / BDD_TILE_SIZE; TileX * BDD_TILE_SIZE < Rect.right; TileX++) {
+                if (m_pTileHashes != NULL) {
+                    m_pTileHashes[TileY * TileColumns + TileX] = 0;
+                }
+                if (m_pTilePolicies != NULL) {
+                    m_pTilePolicies[TileY * TileColumns + TileX].Stale = TRUE;
+                }
+            }
+        }
+    }
+}
+
+BOOLEAN BDD_HWBLT::ReserveDamage(UINT NumInputRects) {
+    PAGED_CODE();
+
+    UINT Capacity = max(NumInputRects * 4, BDD_MIN_DAMAGE_RECTS);
+    if (Capacity <= m_DamageCapacity) {
+        return TRUE;
+    }
+
+    RECT *pDamage = new (PagedPool) RECT[Capacity];
+    if (!pDamage) {
+        return FALSE;
+    }
+    delete[] m_pDamage;
+    m_pDamage = pDamage;
+    m_DamageCapacity = Capacity;
+    m_Stats.Allocations++;
+    return TRUE;
+}
+
+BOOLEAN BDD_HWBLT::DetectChanges(
+    _In_ PDO_PRESENT_MEMORY Context,
+    CONST BLT_INFO *pSrc,
+    _Outptr_result_buffer_(*pNumRects) CONST RECT **ppRects,
+    _Out_ UINT *pNumRects)
+/*++
+
+  Routine Description:
+
+    The method reduces the rects of the present to the parts that changed,
+    according to the change detection mode of the device. Moves are handled
+    like dirty rects since their destination is copied from the source as
+    well.
+
+  Arguments:
+
+    Context - present being executed
+    pSrc - source of the present
+    ppRects - receives the rects to copy
+    pNumRects - receives the number of rects to copy
+
+  Return Value:
+
+    FALSE if the rects of the present must be copied as they are
+
+--*/
+{
+    PAGED_CODE();
+
+    *ppRects = NULL;
+    *pNumRects = 0;
+
+    switch (m_ChangeDetection) {
+    case BDD_CHANGE_DETECTION_SHADOW:
+        if (m_pShadow != NULL) {
+            return DetectShadowChanges(Context, pSrc, ppRects, pNumRects);
+        }
+        break;
+    case BDD_CHANGE_DETECTION_TILE_HASH:
+        if (m_pTileHashes != NULL) {
+            return DetectTileChanges(Context, pSrc, ppRects, pNumRects);
+        }
+        break;
+    case BDD_CHANGE_DETECTION_ADAPTIVE:
+        if (m_pShadow != NULL && m_pTilePolicies != NULL) {
+            return DetectAdaptiveChanges(Context, pSrc, ppRects, pNumRects);
+        }
+        break;
+    default:
+        break;
+    }
+
+    return FALSE;
+}
+
+BOOLEAN BDD_HWBLT::DetectShadowChanges(
+    _In_ PDO_PRESENT_MEMORY Context,
+    CONST BLT_INFO *pSrc,
+    _Outptr_result_buffer_(*pNumRects) CONST RECT **ppRects,
+    _Out_ UINT *pNumRects)
+/*++
+
+  Routine Description:
+
+    The method compares the rects of the present against the shadow frame
+    buffer and returns the spans that changed, updating the shadow
+
+--*/
+{
+    PAGED_CODE();
+
+    BLT_INFO ShadowBltInfo;
+    ShadowBltInfo.pBits = m_pShadow;
+    ShadowBltInfo.Pitch = pSrc->Width * sizeof(ULONG);
+    ShadowBltInfo.BitsPerPel = 32;
+    ShadowBltInfo.Offset.x = 0;
+    ShadowBltInfo.Offset.y = 0;
+    ShadowBltInfo.Rotation = D3DKMDT_VPPR_IDENTITY;
+    ShadowBltInfo.Width = pSrc->Width;
+    ShadowBltInfo.Height = pSrc->Height;
+
+    UINT NumInputRects = Context->NumMoves + Context->NumDirtyRects;
+    if (m_ChangeDetectionValid && m_ChangeDetectionRotation == Context->Rotation && !ReserveDamage(NumInputRects)) {
+        m_ChangeDetectionValid = FALSE;
+    }
+
+    if (!m_ChangeDetectionValid || m_ChangeDetectionRotation != Context->Rotation) {
+        // Only keep the shadow up to date, it can be compared against again once a present covers the whole source
+        BOOLEAN Covered = FALSE;
+        for (UINT i = 0; i < NumInputRects; i++) {
+            RECT Rect = GetPresentRect(Context, i);
+            if (ClipToSource(&Rect, pSrc)) {
+                BltBits(&ShadowBltInfo, pSrc, 1, &Rect);
+                Covered |= (Rect.right - Rect.left) == (LONG)pSrc->Width &&
+                    (Rect.bottom - Rect.top) == (LONG)pSrc->Height;
+            }
+        }
+
+        if (Covered) {
+            m_ChangeDetectionValid = TRUE;
+            m_ChangeDetectionRotation = Context->Rotation;
+        }
+        return FALSE;
+    }
+
+    UINT NumRects = 0;
+    for (UINT i = 0; i < NumInputRects; i++) {
+        RECT Rect = GetPresentRect(Context, i);
+        if (ClipToSource(&Rect, pSrc)) {
+            // Leave at least one rect for each of the remaining input rects
+            UINT MaxSpans = m_DamageCapacity - NumRects - (NumInputRects - i - 1);
+            NumRects += BltDiffRect(pSrc, &ShadowBltInfo, &Rect, m_pDamage + NumRects, MaxSpans);
+        }
+    }
+
+    *ppRects = m_pDamage;
+    *pNumRects = NumRects;
+    return TRUE;
+}
+
+BOOLEAN BDD_HWBLT::DetectTileChanges(
+    _In_ PDO_PRESENT_MEMORY Context,
+    CONST BLT_INFO *pSrc,
+    _Outptr_result_buffer_(*pNumRects) CONST RECT **ppRects,
+    _Out_ UINT *pNumRects)
+/*++
+
+  Routine Description:
+
+    The method hashes every tile touched by the rects of the present and
+    returns the tiles whose hash changed. A changed tile is copied whole,
+    which is valid because the source holds the entire desktop and the rest
+    of the tile already matches it on screen.
+
+--*/
+{
+    PAGED_CODE();
+
+    UINT NumInputRects = Context->NumMoves + Context->NumDirtyRects;
+    if (!ReserveDamage(NumInputRects)) {
+        return FALSE;
+    }
+
+    // The tile grid follows the unrotated source, the hashes of another rotation are meaningless
+    if (m_ChangeDetectionRotation != Context->Rotation) {
+        RtlZeroMemory(m_pTileHashes, m_NumTiles * sizeof(ULONG64));
+        m_ChangeDetectionRotation = Context->Rotation;
+    }
+
+    LONG TileColumns = (pSrc->Width + BDD_TILE_SIZE - 1) / BDD_TILE_SIZE;
+    BDD_ASSERT((UINT)TileColumns * ((pSrc->Height + BDD_TILE_SIZE - 1) / BDD_TILE_SIZE) <= m_NumTiles);
+
+    UINT NumRects = 0;
+    for (UINT i = 0; i < NumInputRects; i++) {
+        RECT Rect = GetPresentRect(Context, i);
+        if (!ClipToSource(&Rect, pSrc)) {
+            continue;
+        }
+
+        // Leave at least one rect for each of the remaining input rects
+        UINT MaxRects = m_DamageCapacity - NumRects - (NumInputRects - i - 1);
+        UINT FirstRect = NumRects;
+        BOOLEAN Overflow = FALSE;
+
+        for (LONG TileY = Rect.top / BDD_TILE_SIZE; TileY * BDD_TILE_SIZE < Rect.bottom; TileY++) {
+            for (LONG TileX = Rect.left / BDD_TILE_SIZE; TileX * BDD_TILE_SIZE < Rect.right; TileX++) {
+                RECT Tile;
+                Tile.left = TileX * BDD_TILE_SIZE;
+                Tile.top = TileY * BDD_TILE_SIZE;
+                Tile.right = min(Tile.left + BDD_TILE_SIZE, (LONG)pSrc->Width);
+                Tile.bottom = min(Tile.top + BDD_TILE_SIZE, (LONG)pSrc->Height);
+
+                // Overlapping rects hash a tile again, but then find it unchanged. A faulted hash is zero, which
+                // leaves the tile unknown and never matches, so the tile is copied and hashed again next time.
+                ULONG64 *pHash = &m_pTileHashes[TileY * TileColumns + TileX];
+                ULONG64 Hash = BltHashRect(pSrc, &Tile);
+                if (Hash != 0 && Hash == *pHash) {
+                    continue;
+                }
+                *pHash = Hash;
+
+                // Once out of rects, the hashes are still updated for all the tiles of the input rect, copied whole
+                if (Overflow) {
+                    continue;
+                }
+
+                RECT *pLast = (NumRects != FirstRect) ? &m_pDamage[NumRects - 1] : NULL;
+                if (pLast != NULL && pLast->top == Tile.top && pLast->right == Tile.left) {
+                    pLast->right = Tile.right;
+                } else if (NumRects - FirstRect < MaxRects) {
+                    m_pDamage[NumRects++] = Tile;
+                } else {
+                    Overflow = TRUE;
+                }
+            }
+        }
+
+        // The new hashes cover the whole tiles, so copying only the input rect would leave the rest of them stale
+        if (Overflow) {
+            NumRects = FirstRect;
+            RECT *pTiles = &m_pDamage[NumRects++];
+            pTiles->left = Rect.left / BDD_TILE_SIZE * BDD_TILE_SIZE;
+            pTiles->top = Rect.top / BDD_TILE_SIZE * BDD_TILE_SIZE;
+            pTiles->right = min((Rect.right + BDD_TILE_SIZE - 1) / BDD_TILE_SIZE * BDD_TILE_SIZE, (LONG)pSrc->Width);
+            pTiles->bottom = min((Rect.bottom + BDD_TILE_SIZE - 1) / BDD_TILE_SIZE * BDD_TILE_SIZE, (LONG)pSrc->Height);
+        }
+    }
+
+    *ppRects = m_pDamage;
+    *pNumRects = NumRects;
+    return TRUE;
+}
+
+BOOLEAN BDD_HWBLT::DetectAdaptiveChanges(
+    _In_ PDO_PRESENT_MEMORY Context,
+    CONST BLT_INFO *pSrc,
+    _Outptr_result_buffer_(*pNumRects) CONST RECT **ppRects,
+    _Out_ UINT *pNumRects)
+/*++
+
+  Routine Description:
+
+    The method splits the rects of the present along the tiles, and either
+    compares each part against the shadow or copies it directly, whichever
+    the measured costs and the change ratio of the tile estimate cheaper.
+    Comparing pays off where few pixels change, like text, copying where
+    the whole tile changes, like video. A directly copied tile leaves its
+    shadow stale, so it is copied whole and its shadow refreshed before it
+    is compared again. A write bound flush also leaves the directly copied
+    tiles that the previous flush wrote to the next flush.
+
+  Arguments:
+
+    Context - present being executed
+    pSrc - source of the present
+    ppRects - receives the rects to copy, valid until the next present
+    pNumRects - receives the number of rects to copy
+
+  Return Value:
+
+    FALSE if the damage could not be grown and the present must be copied
+    as is
+
+--*/
+{
+    PAGED_CODE();
+
+    BLT_INFO ShadowBltInfo;
+    ShadowBltInfo.pBits = m_pShadow;
+    ShadowBltInfo.Pitch = pSrc->Width * sizeof(ULONG);
+    ShadowBltInfo.BitsPerPel = 32;
+    ShadowBltInfo.Offset.x = 0;
+    ShadowBltInfo.Offset.y = 0;
+    ShadowBltInfo.Rotation = D3DKMDT_VPPR_IDENTITY;
+    ShadowBltInfo.Width = pSrc->Width;
+    ShadowBltInfo.Height = pSrc->Height;
+
+    // Unlike the shadow mode, a stale shadow only costs each tile one whole copy
+    if (!m_ChangeDetectionValid || m_ChangeDetectionRotation != Context->Rotation) {
+        SetTilesStale(TRUE);
+        m_ChangeDetectionValid = TRUE;
+        m_ChangeDetectionRotation = Context->Rotation;
+    }
+
+    LONG TileColumns = (pSrc->Width + BDD_TILE_SIZE - 1) / BDD_TILE_SIZE;
+    BDD_ASSERT((UINT)TileColumns * ((pSrc->Height + BDD_TILE_SIZE - 1) / BDD_TILE_SIZE) <= m_NumTiles);
+
+    // Every tile part needs a rect, and a few more for the spans of the compared ones
+    UINT NumInputRects = Context->NumMoves + Context->NumDirtyRects;
+    UINT NumParts = 0;
+    for (UINT i = 0; i < NumInputRects && NumParts < m_NumTiles; i++) {
+        RECT Rect = GetPresentRect(Context, i);
+        if (ClipToSource(&Rect, pSrc)) {
+            NumParts += ((Rect.right - 1) / BDD_TILE_SIZE - Rect.left / BDD_TILE_SIZE + 1) *
+                ((Rect.bottom - 1) / BDD_TILE_SIZE - Rect.top / BDD_TILE_SIZE + 1);
+        }
+    }
+    if (!ReserveDamage(max(NumInputRects, min(NumParts, m_NumTiles)))) {
+        // The shadow misses this present
+        m_ChangeDetectionValid = FALSE;
+        return FALSE;
+    }
+
+    BOOLEAN MayDefer = Context == &m_FlushPresent && m_FlushMayDefer;
+    LONGLONG CompareTicks = 0;
+    LONGLONG ComparedPixels = 0;
+
+    UINT NumRects = 0;
+    for (UINT i = 0; i < NumInputRects; i++) {
+        RECT Rect = GetPresentRect(Context, i);
+        if (!ClipToSource(&Rect, pSrc)) {
+            continue;
+        }
+
+        // Leave at least one rect for each of the remaining input rects
+        UINT MaxRects = m_DamageCapacity - NumRects - (NumInputRects - i - 1);
+        UINT FirstRect = NumRects;
+        BOOLEAN Overflow = FALSE;
+
+        for (LONG TileY = Rect.top / BDD_TILE_SIZE; TileY * BDD_TILE_SIZE < Rect.bottom; TileY++) {
+            for (LONG TileX = Rect.left / BDD_TILE_SIZE; TileX * BDD_TILE_SIZE < Rect.right; TileX++) {
+                RECT Tile;
+                Tile.left = TileX * BDD_TILE_SIZE;
+                Tile.top = TileY * BDD_TILE_SIZE;
+                Tile.right = min(Tile.left + BDD_TILE_SIZE, (LONG)pSrc->Width);
+                Tile.bottom = min(Tile.top + BDD_TILE_SIZE, (LONG)pSrc->Height);
+
+                RECT Part;
+                Part.left = max(Rect.left, Tile.left);
+                Part.top = max(Rect.top, Tile.top);
+                Part.right = min(Rect.right, Tile.right);
+                Part.bottom = min(Rect.bottom, Tile.bottom);
+
+                // Once out of rects the whole input rect is copied as is, without updating the shadow
+                BDD_TILE_POLICY *pPolicy = &m_pTilePolicies[TileY * TileColumns + TileX];
+                if (Overflow || NumRects - FirstRect >= MaxRects) {
+                    Overflow = TRUE;
+                    pPolicy->Stale = TRUE;
+                    continue;
+                }
+
+                // Comparing costs the whole part, and copying the part that changes still costs its copy
+                BOOLEAN Compare = pPolicy->Probe >= BDD_TILE_PROBE_INTERVAL ||
+                    m_CompareCost * 256 < m_CopyCost * (256 - pPolicy->ChangeRatio);
+
+                if (!Compare && MayDefer && !pPolicy->Deferred && pPolicy->LastFlush + 1 == m_FlushSequence) {
+                    KeAcquireGuardedMutex(&m_DeferredLock);
+                    if (!m_DeferredOverflow && !NT_SUCCESS(m_DeferredDamage.UnionRect(&Part))) {
+                        m_DeferredOverflow = TRUE;
+                    }
+                    KeReleaseGuardedMutex(&m_DeferredLock);
+                    pPolicy->Deferred = TRUE;
+                    m_Stats.TilesDeferred++;
+                    continue;
+                }
+                pPolicy->Deferred = FALSE;
+                pPolicy->LastFlush = m_FlushSequence;
+
+                if (Compare && !pPolicy->Stale) {
+                    LARGE_INTEGER Start = KeQueryPerformanceCounter(NULL);
+                    UINT MaxSpans = MaxRects - (NumRects - FirstRect);
+                    UINT NumSpans = BltDiffRect(pSrc, &ShadowBltInfo, &Part, m_pDamage + NumRects, MaxSpans);
+                    CompareTicks += KeQueryPerformanceCounter(NULL).QuadPart - Start.QuadPart;
+
+                    LONGLONG Area = (LONGLONG)(Part.right - Part.left) * (Part.bottom - Part.top);
+                    LONGLONG Changed = 0;
+                    for (UINT j = NumRects; j < NumRects + NumSpans; j++) {
+                        Changed += (LONGLONG)(m_pDamage[j].right - m_pDamage[j].left) *
+                            (m_pDamage[j].bottom - m_pDamage[j].top);
+                    }
+                    ComparedPixels += Area;
+                    NumRects += NumSpans;
+
+                    pPolicy->ChangeRatio = (UCHAR)min((pPolicy->ChangeRatio * 7 + Changed * 256 / Area) / 8, 255);
+                    pPolicy->Probe = 0;
+                    m_Stats.TilesCompared++;
+                    continue;
+                }
+
+                if (Compare) {
+                    // Refreshing the shadow of the whole tile takes the parts deferred by earlier flushes with it, so
+                    // the whole tile is copied as well
+                    BltBits(&ShadowBltInfo, pSrc, 1, &Tile);
+                    pPolicy->Stale = FALSE;
+                    Part = Tile;
+                } else {
+                    pPolicy->Stale = TRUE;
+                    pPolicy->Probe = (UCHAR)min(pPolicy->Probe + 1, BDD_TILE_PROBE_INTERVAL);
+                }
+                m_Stats.TilesCopied++;
+
+                RECT *pLast = (NumRects != FirstRect) ? &m_pDamage[NumRects - 1] : NULL;
+                if (pLast != NULL && pLast->top == Part.top && pLast->bottom == Part.bottom &&
+                    pLast->right == Part.left) {
+                    pLast->right = Part.right;
+                } else {
+                    m_pDamage[NumRects++] = Part;
+                }
+            }
+        }
+
+        if (Overflow) {
+            NumRects = FirstRect;
+            m_pDamage[NumRects++] = Rect;
+        }
+    }
+
+    if (ComparedPixels != 0) {
+        LONGLONG Cost = CompareTicks * m_PicosecondsPerTick * 256 / ComparedPixels;
+        m_CompareCost = (m_CompareCost != 0) ? (m_CompareCost * 7 + Cost) / 8 : Cost;
+    }
+
+    *ppRects = m_pDamage;
+    *pNumRects = NumRects;
+    return TRUE;
+}
+
+VOID BDD_HWBLT::MeasureCopyCost(LONGLONG Pixels, LONGLONG Ticks) {
+    PAGED_CODE();
+
+    if (m_pTilePolicies == NULL) {
+        return;
+    }
+
+    if (Pixels != 0) {
+        LONGLONG Cost = Ticks * m_PicosecondsPerTick * 256 / Pixels;
+        m_CopyCost = (m_CopyCost * 7 + Cost) / 8;
+    }
+}
+
+// Estimated cost in picoseconds of copying a source rect to the frame buffer, without the fixed cost of a rect
+static LONGLONG EstimateCopyCost(CONST BLT_COST_MODEL *pModel, CONST BLT_INFO *pDst, _In_ CONST RECT *pRect) {
+    LONGLONG Width = pRect->right - pRect->left;
+    LONGLONG Height = pRect->bottom - pRect->top;
+    if (Width <= 0 || Height <= 0) {
+        return 0;
+    }
+
+    // A source row is a frame buffer column with these rotations
+    if (pDst->Rotation == D3DKMDT_VPPR_ROTATE90 || pDst->Rotation == D3DKMDT_VPPR_ROTATE270) {
+        LONGLONG Rows = Width;
+        Width = Height;
+        Height = Rows;
+    }
+
+    LONGLONG RowBytes = Width * (pDst->BitsPerPel / 8);
+    LONGLONG Pages = (pDst->Pitch >= PAGE_SIZE) ? Height * (RowBytes / PAGE_SIZE + 1)
+                                                : ((Height - 1) * pDst->Pitch + RowBytes) / PAGE_SIZE + 1;
+    ULONG KiBCost = (Width * Height * sizeof(ULONG) >= pModel->BandMinBytes) ? pModel->BandKiBCost : pModel->KiBCost;
+    return RowBytes * Height * KiBCost / 1024 + Pages * pModel->PageCost;
+}
+
+// Returns TRUE if copying the bounding rect of A and B is estimated to be cheaper than copying them apart
+static BOOLEAN
+ShouldMergeRects(CONST BLT_COST_MODEL *pModel, CONST BLT_INFO *pDst, _In_ CONST RECT *pA, _In_ CONST RECT *pB) {
+    RECT Bounds;
+    Bounds.left = min(pA->left, pB->left);
+    Bounds.top = min(pA->top, pB->top);
+    Bounds.right = max(pA->right, pB->right);
+    Bounds.bottom = max(pA->bottom, pB->bottom);
+
+    // The overlap is copied once, either way
+    RECT Overlap;
+    Overlap.left = max(pA->left, pB->left);
+    Overlap.top = max(pA->top, pB->top);
+    Overlap.right = min(pA->right, pB->right);
+    Overlap.bottom = min(pA->bottom, pB->bottom);
+
+    LONGLONG ApartCost = pModel->RectCost + EstimateCopyCost(pModel, pDst, pA) + EstimateCopyCost(pModel, pDst, pB) -
+        EstimateCopyCost(pModel, pDst, &Overlap);
+    return EstimateCopyCost(pModel, pDst, &Bounds) <= ApartCost;
+}
+
+VOID BDD_HWBLT::MergePresentRects(
+    _In_ PDO_PRESENT_MEMORY Context,
+    CONST BLT_INFO *pDst,
+    CONST BLT_INFO *pSrc,
+    _Inout_ CONST RECT **ppRects,
+    _Inout_ UINT *pNumRects)
+/*++
+
+  Routine Description:
+
+    The method clips the rects of a present to the source and greedily
+    replaces pairs of nearby rects by their bounding rect whenever the cost
+    model measured by BltCalibrate estimates that copying the extra pixels
+    is cheaper than the fixed cost of one more rect and the pages it
+    touches. A rect is only compared with the last BDD_MERGE_WINDOW rects
+    kept, which are the nearest ones for the top to bottom order DWM and
+    change detection use.
+
+  Arguments:
+
+    Context - present being executed
+    pDst - destination of the present
+    pSrc - source of the present
+    ppRects - rects of the present, or NULL for its moves and dirty rects,
+        receives the merged rects
+    pNumRects - number of rects of the present, receives the number of
+        merged rects
+
+  Return Value:
+
+    None, the rects are left as they are if the merged rects cannot be stored
+
+--*/
+{
+    PAGED_CODE();
+
+    UINT NumInputRects = *pNumRects;
+    if (NumInputRects > m_MergeCapacity) {
+        UINT Capacity = max(NumInputRects, BDD_PRESENT_MIN_RECTS);
+        RECT *pMerged = new (PagedPool) RECT[Capacity];
+        if (!pMerged) {
+            return;
+        }
+        delete[] m_pMergedRects;
+        m_pMergedRects = pMerged;
+        m_MergeCapacity = Capacity;
+        m_Stats.Allocations++;
+    }
+
+    BLT_COST_MODEL Model;
+    BltGetCostModel(&Model);
+
+    UINT NumMerged = 0;
+    for (UINT i = 0; i < NumInputRects; i++) {
+        RECT Rect = (*ppRects != NULL) ? (*ppRects)[i] : GetPresentRect(Context, i);
+        if (!ClipToSource(&Rect, pSrc)) {
+            continue;
+        }
+
+        // A merged rect is taken out of the window and compared again, as it may now reach other rects
+        BOOLEAN Merged;
+        do {
+            Merged = FALSE;
+            for (UINT j = NumMerged; j > 0 && NumMerged - j < BDD_MERGE_WINDOW; j--) {
+                RECT *pKept = &m_pMergedRects[j - 1];
+                if (ShouldMergeRects(&Model, pDst, pKept, &Rect)) {
+                    Rect.left = min(Rect.left, pKept->left);
+                    Rect.top = min(Rect.top, pKept->top);
+                    Rect.right = max(Rect.right, pKept->right);
+                    Rect.bottom = max(Rect.bottom, pKept->bottom);
+                    *pKept = m_pMergedRects[--NumMerged];
+                    Merged = TRUE;
+                    break;
+                }
+            }
+        } while (Merged);
+
+        m_pMergedRects[NumMerged++] = Rect;
+    }
+
+    m_Stats.RectsMerged += NumInputRects - NumMerged;
+    *ppRects = m_pMergedRects;
+    *pNumRects = NumMerged;
+}
+
+BOOLEAN BDD_HWBLT::SchedulePresent(
+    _In_ PDO_PRESENT_MEMORY Context,
+    CONST BLT_INFO *pSrc,
+    _In_reads_opt_(NumInputRects) CONST RECT *pInputRects,
+    UINT NumInputRects,
+    _Outptr_result_buffer_(*pNumRects) CONST RECT **ppRects,
+    _Out_ UINT *pNumRects)
+/*++
+
+  Routine Description:
+
+    The method reduces the rects of a present to a banded region clipped to
+    the source, so the move destinations and dirty rects that overlap are
+    copied once. Copied band by band and row by row, the region writes every
+    pixel once and, with the identity rotation, walks the frame buffer pages
+    in ascending address order, so a page is never dirtied again after the
+    hypervisor may have already picked it up.
+
+  Arguments:
+
+    Context - present being executed
+    pSrc - source of the present
+    pInputRects - rects to schedule, or NULL for the moves and dirty rects of the present
+    NumInputRects - number of rects to schedule
+    ppRects - receives the rects of the region
+    pNumRects - receives the number of rects of the region
+
+  Return Value:
+
+    FALSE if the present cannot be scheduled and its rects must be copied as they are
+
+--*/
+{
+    PAGED_CODE();
+
+    *ppRects = NULL;
+    *pNumRects = 0;
+
+    if (NumInputRects == 0 || NumInputRects > BDD_SCHEDULE_MAX_RECTS) {
+        return FALSE;
+    }
+
+    m_PresentRegion.SetEmpty();
+    for (UINT i = 0; i < NumInputRects; i++) {
+        RECT Rect = (pInputRects != NULL) ? pInputRects[i] : GetPresentRect(Context, i);
+        if (!NT_SUCCESS(m_PresentRegion.UnionRect(&Rect))) {
+            return FALSE;
+        }
+    }
+
+    RECT Bounds = {0, 0, (LONG)pSrc->Width, (LONG)pSrc->Height};
+    if (!NT_SUCCESS(m_PresentRegion.IntersectRect(&Bounds))) {
+        return FALSE;
+    }
+
+    *ppRects = m_PresentRegion.GetRects();
+    *pNumRects = m_PresentRegion.GetNumRects();
+    return TRUE;
+}
+
+ULONG BDD_HWBLT::CountPagesWritten(CONST BLT_INFO *pDst, UINT NumRects, _In_reads_(NumRects) CONST RECT *pRects) {
+    PAGED_CODE();
+
+    // The bands are written in ascending address order, so a page is new unless it is the last one written
+    ULONG NumPages = 0;
+    ULONG_PTR LastPage = MAXULONG_PTR;
+    ULONG BytesPerPixel = pDst->BitsPerPel / 8;
+    for (UINT i = 0; i < NumRects;) {
+        UINT BandEnd = i + 1;
+        while (BandEnd < NumRects && pRects[BandEnd].top == pRects[i].top) {
+            BandEnd++;
+        }
+
+        for (LONG y = pRects[i].top; y < pRects[i].bottom; y++) {
+            for (UINT j = i; j < BandEnd; j++) {
+                ULONG_PTR Start = (ULONG_PTR)pDst->pBits + (ULONG_PTR)y * pDst->Pitch + pRects[j].left * BytesPerPixel;
+                ULONG_PTR FirstPage = Start >> PAGE_SHIFT;
+                ULONG_PTR EndPage = (Start + (pRects[j].right - pRects[j].left) * BytesPerPixel - 1) >> PAGE_SHIFT;
+                NumPages += (ULONG)(EndPage - FirstPage + 1) - ((FirstPage == LastPage) ? 1 : 0);
+                LastPage = EndPage;
+            }
+        }
+
+        i = BandEnd;
+    }
+    return NumPages;
+}
+
+BOOLEAN BDD_HWBLT::PanPresent(_In_ PDO_PRESENT_MEMORY Context, CONST BLT_INFO *pDst, CONST BLT_INFO *pSrc)
+/*++
+
+  Routine Description:
+
+    The method executes a present whose moves include a full width
+    vertical scroll of most of the screen by moving the visible frame
+    within the virtual height instead of copying the scrolled rows. The
+    rows the scroll exposes, the rows it does not cover, and the other
+    rects of the present are copied to the new frame, which is then shown
+    with Y_OFFSET.
+
+    The scanout does not wrap around the end of video memory, so once a
+    scroll would leave the virtual height the frame starts over at its
+    other end and is copied whole. With BDD_PAN_FRAMES frames of rows this
+    happens once every few screens of scrolling.
+
+    Nothing is written to the rows shown until Y_OFFSET moves, a present
+    that would write there is executed as usual.
+
+  Arguments:
+
+    Context - present being executed
+    pDst - visible frame of the frame buffer
+    pSrc - source of the present
+
+  Return Value:
+
+    FALSE if the present has no scroll worth panning and must be executed
+    as usual
+
+--*/
+{
+    PAGED_CODE();
+
+    if (Context->Rotation != D3DKMDT_VPPR_IDENTITY) {
+        return FALSE;
+    }
+
+    UINT NumInputRects = Context->NumMoves + Context->NumDirtyRects;
+    if (NumInputRects > BDD_SCHEDULE_MAX_RECTS) {
+        return FALSE;
+    }
+
+    // Panning also re-copies the rows outside the scroll, so it only pays off for scrolls of most of the screen
+    UINT ScrollMove = Context->NumMoves;
+    RECT Scrolled;
+    LONG Dy = 0;
+    for (UINT i = 0; i < Context->NumMoves; i++) {
+        CONST D3DKMT_MOVE_RECT *pMove = &Context->Moves[i];
+        Scrolled = pMove->DestRect;
+        Dy = pMove->SourcePoint.y - Scrolled.top;
+        if (pMove->SourcePoint.x != Scrolled.left || Dy == 0 || !ClipToSource(&Scrolled, pSrc)) {
+            continue;
+        }
+        if (Scrolled.left == 0 && Scrolled.right == (LONG)pSrc->Width && Scrolled.top + Dy >= 0 &&
+            Scrolled.bottom + Dy <= (LONG)pSrc->Height && (Scrolled.bottom - Scrolled.top) * 2 > (LONG)pSrc->Height) {
+            ScrollMove = i;
+            break;
+        }
+    }
+    if (ScrollMove == Context->NumMoves) {
+        return FALSE;
+    }
+
+    // Content moving up shows rows further down the frame buffer
+    LONG Row = (LONG)m_PanRow + Dy;
+    BOOLEAN Rebased = Row < 0 || Row + (LONG)pSrc->Height > (LONG)Context->DstPanRows;
+    if (Rebased) {
+        // Only a virtual height of two frames keeps the whole frame copied away from the visible one
+        if (Context->DstPanRows < 2 * pSrc->Height) {
+            return FALSE;
+        }
+        Row = (Dy > 0) ? 0 : (LONG)(Context->DstPanRows - pSrc->Height);
+    }
+
+    RECT Bounds = {0, 0, (LONG)pSrc->Width, (LONG)pSrc->Height};
+    NTSTATUS Status = m_PresentRegion.SetRect(&Bounds);
+    if (NT_SUCCESS(Status) && !Rebased) {
+        Status = m_PresentRegion.SubtractRect(&Scrolled);
+    }
+    for (UINT i = 0; NT_SUCCESS(Status) && i < NumInputRects; i++) {
+        if (i != ScrollMove) {
+            RECT Rect = GetPresentRect(Context, i);
+            Status = m_PresentRegion.UnionRect(&Rect);
+        }
+    }
+    if (NT_SUCCESS(Status)) {
+        Status = m_PresentRegion.IntersectRect(&Bounds);
+    }
+    if (!NT_SUCCESS(Status)) {
+        return FALSE;
+    }
+
+    // The visible frame, in the rows of the new one, would show the rows written to it before Y_OFFSET moves
+    LONG VisibleTop = (LONG)m_PanRow - Row;
+    LONG VisibleBottom = VisibleTop + (LONG)pSrc->Height;
+    CONST RECT *pRects = m_PresentRegion.GetRects();
+    for (UINT i = 0; i < m_PresentRegion.GetNumRects(); i++) {
+        if (pRects[i].top < VisibleBottom && pRects[i].bottom > VisibleTop) {
+            return FALSE;
+        }
+    }
+
+    // Everything is written before the frame is shown, so exposed rows below or above the old frame never show stale
+    BLT_INFO PanBltInfo = *pDst;
+    PanBltInfo.pBits = reinterpret_cast<BYTE *>(pDst->pBits) + ((LONG_PTR)Row - (LONG_PTR)m_PanRow) * pDst->Pitch;
+    BOOLEAN Copied = BltPresentBands(&PanBltInfo, pSrc, m_PresentRegion.GetNumRects(), m_PresentRegion.GetRects());
+    BltFlush();
+
+    m_DevExt->PanFrameBuffer(m_SourceId, (UINT)Row);
+    m_PanRow = (UINT)Row;
+
+    ScrollChangeDetection(pSrc, &Scrolled, Dy, Rebased);
+    if (!Copied) {
+        InvalidatePresentRects(Context, pSrc);
+    }
+
+    m_Stats.ScrollsPanned++;
+    if (Rebased) {
+        m_Stats.PanRebases++;
+    }
+    return TRUE;
+}
+
+VOID BDD_HWBLT::ScrollChangeDetection(CONST BLT_INFO *pSrc, _In_ CONST RECT *pScrolled, LONG Dy, BOOLEAN Rebased) {
+    PAGED_CODE();
+
+    // The whole frame moved, the hashes of its tiles no longer describe what is on screen, and the shadow rows moved
+    // with it out of the tiles they were stale in
+    if (m_pTileHashes != NULL) {
+        RtlZeroMemory(m_pTileHashes, m_NumTiles * sizeof(ULONG64));
+    }
+    if (m_pTilePolicies != NULL) {
+        SetTilesStale(TRUE);
+    }
+
+    if (m_pShadow == NULL) {
+        return;
+    }
+
+    BLT_INFO ShadowBltInfo;
+    ShadowBltInfo.pBits = m_pShadow;
+    ShadowBltInfo.Pitch = pSrc->Width * sizeof(ULONG);
+    ShadowBltInfo.BitsPerPel = 32;
+    ShadowBltInfo.Offset.x = 0;
+    ShadowBltInfo.Offset.y = 0;
+    ShadowBltInfo.Rotation = D3DKMDT_VPPR_IDENTITY;
+    ShadowBltInfo.Width = pSrc->Width;
+    ShadowBltInfo.Height = pSrc->Height;
+
+    // Scroll the shadow like the frame, then copy what was written to the frame
+    if (!Rebased) {
+        RtlMoveMemory(
+            m_pShadow + (SIZE_T)pScrolled->top * ShadowBltInfo.Pitch,
+            m_pShadow + (SIZE_T)(pScrolled->top + Dy) * ShadowBltInfo.Pitch,
+            (SIZE_T)(pScrolled->bottom - pScrolled->top) * ShadowBltInfo.Pitch);
+    }
+    BltBits(&ShadowBltInfo, pSrc, m_PresentRegion.GetNumRects(), m_PresentRegion.GetRects());
+
+    if (Rebased) {
+        m_ChangeDetectionValid = TRUE;
+        m_ChangeDetectionRotation = D3DKMDT_VPPR_IDENTITY;
+    }
+}
+
+BDD_HWBLT::BDD_HWBLT()
+    : m_SourceId(D3DDDI_ID_UNINITIALIZED),              //
+      m_DevExt(NULL),                                   //
+      m_pPresentWorkerThread(NULL),                     //
+      m_QueueHead(0),                                   //
+      m_QueueTail(0),                                   //
+      m_Paced(FALSE),                                   //
+      m_pCoalescedRects(NULL),                          //
+      m_CoalescedCapacity(0),                           //
+      m_FlushInterval(0),                               //
+      m_pBackBuffer(NULL),                              //
+      m_BackBufferSize(0),                              //
+      m_DeferredOverflow(FALSE),                        //
+      m_DeferredDstAddr(NULL),                          //
+      m_DeferredDstBitPerPixel(0),                      //
+      m_DeferredRotation(D3DKMDT_VPPR_IDENTITY),        //
+      m_pFlushRects(NULL),                              //
+      m_FlushCapacity(0),                               //
+      m_DarkProcess(NULL),                              //
+      m_DarkOverflow(FALSE),                            //
+      m_DarkPending(FALSE),                             //
+      m_WriteBudget(0),                                 //
+      m_BudgetTokens(0),                                //
+      m_BudgetBurst(0),                                 //
+      m_SourceCacheClock(0),                            //
+      m_LockFailedSource(NULL),                         //
+      m_ChangeDetection(BDD_CHANGE_DETECTION_NONE),     //
+      m_pShadow(NULL),                                  //
+      m_ShadowSize(0),                                  //
+      m_pTileHashes(NULL),                              //
+      m_pTilePolicies(NULL),                            //
+      m_NumTiles(0),                                    //
+      m_ChangeDetectionValid(FALSE),                    //
+      m_ChangeDetectionRotation(D3DKMDT_VPPR_IDENTITY), //
+      m_pDamage(NULL),                                  //
+      m_DamageCapacity(0),                              //
+      m_CopyCost(0),                                    //
+      m_CompareCost(0),                                 //
+      m_PicosecondsPerTick(0),                          //
+      m_FlushSequence(0),                               //
+      m_FlushWriteBound(FALSE),                         //
+      m_FlushMayDefer(FALSE),                           //
+      m_pMergedRects(NULL),                             //
+      m_MergeCapacity(0),                               //
+      m_BackFrame(1),                                   //
+      m_PanRow(0) {
+    PAGED_CODE();
+
+    m_FrameStale[0] = TRUE;
+    m_FrameStale[1] = TRUE;
+
+    RtlZeroMemory(&m_PresentContext, sizeof(m_PresentContext));
+    RtlZeroMemory(&m_PresentQueue, sizeof(m_PresentQueue));
+    RtlZeroMemory(&m_CoalescedPresent, sizeof(m_CoalescedPresent));
+    RtlZeroMemory(&m_FlushPresent, sizeof(m_FlushPresent));
+    RtlZeroMemory(&m_DarkPresent, sizeof(m_DarkPresent));
+    m_BudgetRefillTime.QuadPart = 0;
+    RtlZeroMemory(&m_SourceCache, sizeof(m_SourceCache));
+    RtlZeroMemory(&m_Stats, sizeof(m_Stats));
+
+    // The regions grow on the present path like the other present buffers
+    m_DeferredDamage.SetAllocationCounter(&m_Stats.Allocations);
+    m_DarkDamage.SetAllocationCounter(&m_Stats.Allocations);
+    m_QueuedDamage.SetAllocationCounter(&m_Stats.Allocations);
+    m_PresentRegion.SetAllocationCounter(&m_Stats.Allocations);
+    m_FlipDamage.SetAllocationCounter(&m_Stats.Allocations);
+
+    KeInitializeEvent(&m_StopWorkerEvent, NotificationEvent, FALSE);
+    KeInitializeEvent(&m_PresentTickEvent, SynchronizationEvent, FALSE);
+    KeInitializeEvent(&m_DrainPresentsEvent, NotificationEvent, FALSE);
+    KeInitializeSemaphore(&m_QueuedPresents, 0, BDD_PRESENT_QUEUE_DEPTH);
+    KeInitializeSemaphore(&m_FreePresentEntries, BDD_PRESENT_QUEUE_DEPTH, BDD_PRESENT_QUEUE_DEPTH);
+    KeInitializeGuardedMutex(&m_DrainLock);
+    KeInitializeGuardedMutex(&m_SourceCacheLock);
+    KeInitializeGuardedMutex(&m_FlushLock);
+    KeInitializeGuardedMutex(&m_DeferredLock);
+    KeInitializeGuardedMutex(&m_DarkLock);
+    ExInitializeRundownProtection(&m_NotifyRundown);
+
+    ExAcquireFastMutex(&gBddSourcesLock);
+    InsertTailList(&gBddSources, &m_SourceLink);
+    ExReleaseFastMutex(&gBddSourcesLock);
+}
+
+BDD_HWBLT::~BDD_HWBLT()
+/*++
+
+  Routine Description:
+
+    This routine waits on present worker thread to exit before
+    destroying the object
+
+  Arguments:
+
+    None
+
+  Return Value:
+
+    None
+
+--*/
+{
+    PAGED_CODE();
+
+    StopPresentWorker();
+    DiscardDarkPresents(NULL);
+    InvalidateSourceCache(NULL);
+
+    // The source stays in the list until ProcessNotify is done with it, as it resumes the walk from its link
+    ExWaitForRundownProtectionRelease(&m_NotifyRundown);
+    ExAcquireFastMutex(&gBddSourcesLock);
+    RemoveEntryList(&m_SourceLink);
+    ExReleaseFastMutex(&gBddSourcesLock);
+
+    for (UINT i = 0; i < BDD_PRESENT_QUEUE_DEPTH; i++) {
+        delete[] m_PresentQueue[i].pMoveStore;
+        delete[] m_PresentQueue[i].pDirtyRectStore;
+    }
+
+    FreeChangeDetection();
+    delete[] m_pDamage;
+    delete[] m_pMergedRects;
+    delete[] m_pCoalescedRects;
+    delete[] m_pBackBuffer;
+    delete[] m_pFlushRects;
+
+    BDD_LOG_INFO(
+        "Source %u: %I64u presents, %I64u present allocations, %I64u source cache hits, %I64u misses, "
+        "%I64u pages written by %I64u scheduled presents, %I64u rects merged, %I64u copy ticks, "
+        "%I64u scrolls panned with %I64u rebases, %I64u presents coalesced, %I64u bytes throttled for "
+        "%I64u ticks, %I64u deferred flushes, %I64u tiles compared, %I64u copied, %I64u deferred, "
+        "%I64u dark presents caught up by %I64u presents",
+        m_SourceId,
+        m_Stats.Presents,
+        m_Stats.Allocations,
+        m_Stats.SourceCacheHits,
+        m_Stats.SourceCacheMisses,
+        m_Stats.PagesWritten,
+        m_Stats.ScheduledPresents,
+        m_Stats.RectsMerged,
+        m_Stats.CopyTicks,
+        m_Stats.ScrollsPanned,
+        m_Stats.PanRebases,
+        m_Stats.PresentsCoalesced,
+        m_Stats.ThrottledBytes,
+        m_Stats.ThrottleTicks,
+        m_Stats.DeferredFlushes,
+        m_Stats.TilesCompared,
+        m_Stats.TilesCopied,
+        m_Stats.TilesDeferred,
+        m_Stats.DarkPresents,
+        m_Stats.DarkCatchUps);
+}
+
+VOID BDD_HWBLT::RegisterProcessNotify() {
+    PAGED_CODE();
+
+    InitializeListHead(&gBddSources);
+    ExInitializeFastMutex(&gBddSourcesLock);
+
+    NTSTATUS Status = PsSetCreateProcessNotifyRoutine(ProcessNotify, FALSE);
+    if (!NT_SUCCESS(Status)) {
+        BDD_LOG_WARNING(
+            "PsSetCreateProcessNotifyRoutine failed with status 0x%x, source surfaces are not cached",
+            Status);
+    }
+    gBddSourceCacheEnabled = NT_SUCCESS(Status);
+}
+
+VOID BDD_HWBLT::UnregisterProcessNotify() {
+    PAGED_CODE();
+
+    if (gBddSourceCacheEnabled) {
+        PsSetCreateProcessNotifyRoutine(ProcessNotify, TRUE);
+        gBddSourceCacheEnabled = FALSE;
+    }
+}
+
+VOID BDD_HWBLT::ProcessNotify(_In_ HANDLE ParentId, _In_ HANDLE ProcessId, _In_ BOOLEAN Create)
+/*++
+
+  Routine Description:
+
+    The routine unlocks the dark source and the cached source mappings of
+    an exiting process, its address space cannot be deleted while its pages
+    are locked
+
+  Arguments:
+
+    ParentId - unused
+    ProcessId - unused, the routine runs in the context of the exiting process
+    Create - TRUE if the process is being created
+
+  Return Value:
+
+    None
+
+--*/
+{
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER(ParentId);
+    UNREFERENCED_PARAMETER(ProcessId);
+
+    if (Create) {
+        return;
+    }
+
+    PEPROCESS Process = PsGetCurrentProcess();
+
+    // The fast mutex raises to APC_LEVEL, so the lock is dropped while waiting on the presents of a source
+    ExAcquireFastMutex(&gBddSourcesLock);
+    for (LIST_ENTRY *pLink = gBddSources.Flink; pLink != &gBddSources; pLink = pLink->Flink) {
+        BDD_HWBLT *pSource = CONTAINING_RECORD(pLink, BDD_HWBLT, m_SourceLink);
+        if (!ExAcquireRundownProtection(&pSource->m_NotifyRundown)) {
+            // Being destroyed, its mappings were already unlocked
+            continue;
+        }
+        ExReleaseFastMutex(&gBddSourcesLock);
+
+        // The dark source may hold a reference on a cached mapping, so it is unlocked first
+        pSource->DiscardDarkPresents(Process);
+        if (pSource->InvalidateSourceCache(Process)) {
+            // The stale mappings are unlocked as their presents complete
+            pSource->WaitForPresents();
+        }
+
+        ExAcquireFastMutex(&gBddSourcesLock);
+        ExReleaseRundownProtection(&pSource->m_NotifyRundown);
+    }
+    ExReleaseFastMutex(&gBddSourcesLock);
+}
+
+VOID BDD_HWBLT::UnlockSourceMapping(_Inout_ BDD_SOURCE_MAPPING *pMapping) {
+    PAGED_CODE();
+
+    UnlockPresentSource(pMapping->Mdl);
+    RtlZeroMemory(pMapping, sizeof(*pMapping));
+}
+
+BOOLEAN BDD_HWBLT::InvalidateSourceCache(_In_opt_ PEPROCESS Process) {
+    PAGED_CODE();
+
+    BOOLEAN Referenced = FALSE;
+
+    KeAcquireGuardedMutex(&m_SourceCacheLock);
+    for (UINT i = 0; i < BDD_SOURCE_CACHE_SIZE; i++) {
+        BDD_SOURCE_MAPPING *pMapping = &m_SourceCache[i];
+        if (pMapping->Mdl == NULL || (Process != NULL && pMapping->Process != Process)) {
+            continue;
+        }
+
+        if (pMapping->References == 0) {
+            UnlockSourceMapping(pMapping);
+        } else {
+            pMapping->Stale = TRUE;
+            Referenced = TRUE;
+        }
+    }
+    KeReleaseGuardedMutex(&m_SourceCacheLock);
+
+    return Referenced;
+}
+
+NTSTATUS BDD_HWBLT::AcquirePresentSource(_Inout_ PDO_PRESENT_MEMORY Context, _In_ BYTE *SrcAddr, SIZE_T Size)
+/*++
+
+  Routine Description:
+
+    The method looks up the source surface in the mapping cache, locking
+    and mapping it on a miss. A cached mapping is only used while its pages
+    are still mapped at the surface address. If no cache entry can be
+    reused, the surface is locked for this present only.
+
+  Arguments:
+
+    Context - present receiving the system space address of the source
+    SrcAddr - address of source surface in the current process
+    Size - size of source surface in bytes
+
+  Return Value:
+
+    Status
+
+--*/
+{
+    PAGED_CODE();
+
+    PEPROCESS Process = PsGetCurrentProcess();
+    LONG Pitch = Context->SrcPitch;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    Context->pMapping = NULL;
+    Context->Mdl = NULL;
+
+    KeAcquireGuardedMutex(&m_SourceCacheLock);
+
+    BDD_SOURCE_MAPPING *pVictim = NULL;
+    for (UINT i = 0; i < BDD_SOURCE_CACHE_SIZE; i++) {
+        BDD_SOURCE_MAPPING *pMapping = &m_SourceCache[i];
+        if (pMapping->Mdl != NULL && !pMapping->Stale && pMapping->Process == Process &&
+            pMapping->UserAddr == SrcAddr && pMapping->Pitch == Pitch && pMapping->Size == Size) {
+            if (IsPresentSourceMapped(SrcAddr, Size, pMapping->Mdl)) {
+                pMapping->References++;
+                pMapping->LastUse = ++m_SourceCacheClock;
+                Context->pMapping = pMapping;
+                Context->SrcAddr = pMapping->SystemAddr;
+                m_Stats.SourceCacheHits++;
+                goto Exit;
+            }
+
+            // The surface was freed and another one allocated at the same address, the cached pages are not its own
+            if (pMapping->References == 0) {
+                UnlockSourceMapping(pMapping);
+            } else {
+                pMapping->Stale = TRUE;
+            }
+        }
+
+        // Prefer a free entry, then the least recently used one without presents
+        if (pMapping->Mdl == NULL) {
+            if (pVictim == NULL || pVictim->Mdl != NULL) {
+                pVictim = pMapping;
+            }
+        } else if (
+            pMapping->References == 0 &&
+            (pVictim == NULL || (pVictim->Mdl != NULL && pMapping->LastUse < pVictim->LastUse))) {
+            pVictim = pMapping;
+        }
+    }
+
+    m_Stats.SourceCacheMisses++;
+
+    if (!gBddSourceCacheEnabled) {
+        pVictim = NULL;
+    }
+
+    PMDL Mdl;
+    BYTE *SystemAddr;
+    Status = LockPresentSource(SrcAddr, Size, &Mdl, &SystemAddr);
+    if (!NT_SUCCESS(Status)) {
+        goto Exit;
+    }
+
+    if (pVictim == NULL) {
+        Context->Mdl = Mdl;
+    } else {
+        if (pVictim->Mdl != NULL) {
+            UnlockSourceMapping(pVictim);
+        }
+        pVictim->Process = Process;
+        pVictim->UserAddr = SrcAddr;
+        pVictim->Pitch = Pitch;
+        pVictim->Size = Size;
+        pVictim->Mdl = Mdl;
+        pVictim->SystemAddr = SystemAddr;
+        pVictim->References = 1;
+        pVictim->Stale = FALSE;
+        pVictim->LastUse = ++m_SourceCacheClock;
+        Context->pMapping = pVictim;
+    }
+    Context->SrcAddr = SystemAddr;
+
+Exit:
+    KeReleaseGuardedMutex(&m_SourceCacheLock);
+    return Status;
+}
+
+VOID BDD_HWBLT::ReleasePresentSource(_Inout_ PDO_PRESENT_MEMORY Context) {
+    PAGED_CODE();
+
+    if (Context->Mdl != NULL) {
+        UnlockPresentSource(Context->Mdl);
+        Context->Mdl = NULL;
+    }
+
+    BDD_SOURCE_MAPPING *pMapping = Context->pMapping;
+    if (pMapping != NULL) {
+        KeAcquireGuardedMutex(&m_SourceCacheLock);
+        BDD_ASSERT(pMapping->References != 0);
+        if (--pMapping->References == 0 && pMapping->Stale) {
+            UnlockSourceMapping(pMapping);
+        }
+        KeReleaseGuardedMutex(&m_SourceCacheLock);
+        Context->pMapping = NULL;
+    }
+}
+
+NTSTATUS BDD_HWBLT::StartPresentWorker(BOOLEAN Paced, ULONG WriteBudget, ULONG FlushInterval)
+/*++
+
+  Routine Description:
+
+    The method creates the present worker thread of this source
+
+  Arguments:
+
+    Paced - whether the worker waits for a tick of the VSync timer before
+            executing presents
+    WriteBudget - bytes of damage the worker may write per second, 0 if
+                  unlimited
+    FlushInterval - milliseconds between the flushes of the deferred I/O
+                    back buffer, 0 if presents are not deferred
+
+  Return Value:
+
+    Status
+
+--*/
+{
+    PAGED_CODE();
+
+    if (m_pPresentWorkerThread != NULL) {
+        return STATUS_SUCCESS;
+    }
+
+    KeClearEvent(&m_StopWorkerEvent);
+    KeClearEvent(&m_PresentTickEvent);
+    m_Paced = Paced;
+
+    // The bucket starts full
+    m_WriteBudget = WriteBudget;
+    m_BudgetBurst = max((LONGLONG)WriteBudget * BDD_BUDGET_BURST_MS / 1000, 1);
+    m_BudgetTokens = m_BudgetBurst;
+    m_BudgetRefillTime = KeQueryPerformanceCounter(NULL);
+
+    // Read by the worker as soon as it starts
+    m_FlushInterval = FlushInterval;
+
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    InitializeObjectAttributes(&ObjectAttributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
+
+    HANDLE hThread;
+    NTSTATUS Status = PsCreateSystemThread(
+        &hThread,
+        THREAD_ALL_ACCESS,
+        &ObjectAttributes,
+        NULL,
+        NULL,
+        PresentWorkerThread,
+        this);
+    if (!NT_SUCCESS(Status)) {
+        BDD_LOG_ERROR("PsCreateSystemThread failed with status 0x%x", Status);
+        m_FlushInterval = 0;
+        return Status;
+    }
+
+    PKTHREAD pThread;
+    Status = ObReferenceObjectByHandle(hThread, THREAD_ALL_ACCESS, *PsThreadType, KernelMode, (PVOID *)&pThread, NULL);
+    if (!NT_SUCCESS(Status)) {
+        // Cannot happen with a kernel handle to a thread that was just created
+        BDD_LOG_ASSERTION("ObReferenceObjectByHandle failed with status 0x%x", Status);
+        KeSetEvent(&m_StopWorkerEvent, IO_NO_INCREMENT, FALSE);
+        ZwWaitForSingleObject(hThread, FALSE, NULL);
+        ZwClose(hThread);
+        return Status;
+    }
+    ZwClose(hThread);
+
+    m_pPresentWorkerThread = pThread;
+    return STATUS_SUCCESS;
+}
+
+VOID BDD_HWBLT::StopPresentWorker()
+/*++
+
+  Routine Description:
+
+    The method completes the queued presents, then waits on present worker
+    thread to exit
+
+  Arguments:
+
+    None
+
+  Return Value:
+
+    None
+
+--*/
+{
+    PAGED_CODE();
+
+    if (m_pPresentWorkerThread == NULL) {
+        return;
+    }
+
+    WaitForPresents();
+
+    KeSetEvent(&m_StopWorkerEvent, IO_NO_INCREMENT, FALSE);
+    KeWaitForSingleObject(m_pPresentWorkerThread, Executive, KernelMode, FALSE, NULL);
+    ObDereferenceObject(m_pPresentWorkerThread);
+    m_pPresentWorkerThread = NULL;
+}
+
+VOID BDD_HWBLT::WaitForPresents()
+/*++
+
+  Routine Description:
+
+    The method waits until the worker thread has executed and completed
+    all the queued presents. Presents must not be queued concurrently, but
+    several threads may drain the queue at once.
+
+  Arguments:
+
+    None
+
+  Return Value:
+
+    None
+
+--*/
+{
+    PAGED_CODE();
+
+    if (m_pPresentWorkerThread == NULL) {
+        return;
+    }
+
+    // Deferred presents are complete once their damage is flushed, nothing is queued to a deferred I/O worker
+    if (m_FlushInterval != 0) {
+        FlushBackBuffer(FALSE);
+        return;
+    }
+
+    // Entries are only freed once their present has been completed, so owning all of them means the queue is idle.
+    // Presents waiting for the write budget are executed right away meanwhile.
+    KeAcquireGuardedMutex(&m_DrainLock);
+    KeSetEvent(&m_DrainPresentsEvent, IO_NO_INCREMENT, FALSE);
+    for (UINT i = 0; i < BDD_PRESENT_QUEUE_DEPTH; i++) {
+        KeWaitForSingleObject(&m_FreePresentEntries, Executive, KernelMode, FALSE, NULL);
+    }
+    KeClearEvent(&m_DrainPresentsEvent);
+    KeReleaseSemaphore(&m_FreePresentEntries, IO_NO_INCREMENT, BDD_PRESENT_QUEUE_DEPTH, FALSE);
+    KeReleaseGuardedMutex(&m_DrainLock);
+}
+
+VOID BDD_HWBLT::PresentWorkerThread(_In_ PVOID StartContext) {
+    PAGED_CODE();
+
+    reinterpret_cast<BDD_HWBLT *>(StartContext)->PresentWorker();
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+VOID BDD_HWBLT::PresentWorker()
+/*++
+
+  Routine Description:
+
+    The routine executes the queued presents in order and reports their
+    completion to the OS. Paced presents are executed on the next tick, all
+    the presents queued by then at once. Presents over the write budget
+    wait for it the same way.
+
+  Arguments:
+
+    None
+
+  Return Value:
+
+    None
+
+--*/
+{
+    PAGED_CODE();
+
+    // DWM waits on the completion of a present to compose the next frame, so the copy must not be delayed by the
+    // threads of the desktop
+    KeSetPriorityThread(KeGetCurrentThread(), BDD_PRESENT_THREAD_PRIORITY);
+
+    if (m_FlushInterval != 0) {
+        FlushWorker();
+        return;
+    }
+
+    const DXGKRNL_INTERFACE *pDxgkInterface = m_DevExt->GetDxgkInterface();
+
+    for (;;) {
+        // Queued presents are satisfied first, as WaitAny returns the lowest signaled index
+        PVOID WaitObjects[] = {&m_QueuedPresents, &m_StopWorkerEvent};
+        NTSTATUS Status = KeWaitForMultipleObjects(
+            ARRAYSIZE(WaitObjects),
+            WaitObjects,
+            WaitAny,
+            Executive,
+            KernelMode,
+            FALSE,
+            NULL,
+            NULL);
+        if (Status != STATUS_WAIT_0) {
+            break;
+        }
+
+        UINT NumPresents = m_Paced ? WaitForPresentTick() : 1;
+        if (m_WriteBudget != 0) {
+            NumPresents = WaitForWriteBudget(NumPresents);
+        }
+        BOOLEAN Coalesced = NumPresents > 1 && CoalescePresents(NumPresents);
+        if (Coalesced) {
+            HwExecutePresentDisplayOnly(&m_CoalescedPresent);
+            m_Stats.PresentsCoalesced += NumPresents - 1;
+        }
+
+        for (UINT i = 0; i < NumPresents; i++) {
+            BDD_PRESENT_ENTRY *pEntry = &m_PresentQueue[m_QueueHead];
+            if (!Coalesced) {
+                HwExecutePresentDisplayOnly(&pEntry->Present);
+            }
+            ReleasePresentSource(&pEntry->Present);
+
+            DXGKARGCB_PRESENT_DISPLAYONLY_PROGRESS Progress;
+            Progress.VidPnSourceId = m_SourceId;
+            Progress.ProgressId = DXGK_PRESENT_DISPLAYONLY_PROGRESS_ID_COMPLETE;
+            pDxgkInterface->DxgkCbPresentDisplayOnlyProgress(pDxgkInterface->DeviceHandle, &Progress);
+
+            m_QueueHead = (m_QueueHead + 1) % BDD_PRESENT_QUEUE_DEPTH;
+            KeReleaseSemaphore(&m_FreePresentEntries, IO_NO_INCREMENT, 1, FALSE);
+        }
+    }
+}
+
+UINT BDD_HWBLT::WaitForPresentTick()
+/*++
+
+  Routine Description:
+
+    The method waits for the next tick of the VSync timer, then takes the
+    presents queued after the one the worker already took. The tick event
+    stays set while the worker is idle, so the first present after a pause
+    is executed right away.
+
+  Arguments:
+
+    None
+
+  Return Value:
+
+    Number of queued presents to execute, including the one already taken
+
+--*/
+{
+    PAGED_CODE();
+
+    LARGE_INTEGER Timeout;
+    Timeout.QuadPart = -10000LL * BDD_PACING_TIMEOUT_MS;
+    KeWaitForSingleObject(&m_PresentTickEvent, Executive, KernelMode, FALSE, &Timeout);
+
+    UINT NumPresents = 1;
+    LARGE_INTEGER NoWait;
+    NoWait.QuadPart = 0;
+    while (NumPresents < BDD_PRESENT_QUEUE_DEPTH &&
+           KeWaitForSingleObject(&m_QueuedPresents, Executive, KernelMode, FALSE, &NoWait) == STATUS_SUCCESS) {
+        NumPresents++;
+    }
+    return NumPresents;
+}
+
+UINT BDD_HWBLT::WaitForWriteBudget(UINT NumPresents)
 /*++
 
   Routine Description:
 
-    The routine executes present's commands and report progress to the OS
+    The method charges the damage of the presents the worker took to the
+    write budget, waiting until the token bucket holds enough for it. The
+    presents queued while waiting are taken as well and their damage added,
+    so the frame eventually written is always the newest one, and no
+    present waits longer than it takes the bucket to refill. Damage larger
+    than the bucket goes through once it is full and leaves the bucket in
+    debt for the following presents, by one burst at most. The wait ends
+    early when the worker is stopped or the queue is drained.
 
   Arguments:
 
-    Context - Context with present's command
+    NumPresents - number of queued presents already taken by the worker
 
   Return Value:
 
-    None
+    Number of queued presents to execute
 
 --*/
 {
     PAGED_CODE();
 
-    // Set up destination blt info
-    BLT_INFO DstBltInfo;
-    DstBltInfo.pBits = Context->DstAddr;
-    DstBltInfo.Pitch = Context->DstStride;
-    DstBltInfo.BitsPerPel = Context->DstBitPerPixel;
-    DstBltInfo.Offset.x = 0;
-    DstBltInfo.Offset.y = 0;
-    DstBltInfo.Rotation = Context->Rotation;
-    DstBltInfo.Width = Context->SrcWidth;
-    DstBltInfo.Height = Context->SrcHeight;
+    LARGE_INTEGER Frequency;
+    LARGE_INTEGER Start = KeQueryPerformanceCounter(&Frequency);
+    ULONGLONG Damage = GetQueuedDamage(NumPresents);
+    BOOLEAN Throttled = FALSE;
 
-    // Set up source blt info
+    for (;;) {
+        // The bucket is full after a burst worth of time, so longer pauses do not need to be counted
+        LARGE_INTEGER Now = KeQueryPerformanceCounter(NULL);
+        LONGLONG Elapsed = min(Now.QuadPart - m_BudgetRefillTime.QuadPart, Frequency.QuadPart);
+        m_BudgetTokens = min(m_BudgetTokens + Elapsed * m_WriteBudget / Frequency.QuadPart, m_BudgetBurst);
+        m_BudgetRefillTime = Now;
+
+        LONGLONG Needed = min((LONGLONG)Damage, m_BudgetBurst);
+        if (m_BudgetTokens >= Needed) {
+            break;
+        }
+
+        // Relative timeout in 100ns units until the bucket holds enough, rounded up so the wait always makes progress
+        Throttled = TRUE;
+        LARGE_INTEGER Timeout;
+        Timeout.QuadPart = -((Needed - m_BudgetTokens) * 10000000LL / m_WriteBudget + 1);
+
+        // Presents are only taken while the queue has some left, as the last wait object
+        PVOID WaitObjects[] = {&m_StopWorkerEvent, &m_DrainPresentsEvent, &m_QueuedPresents};
+        ULONG NumWaitObjects = (NumPresents < BDD_PRESENT_QUEUE_DEPTH) ? 3 : 2;
+        NTSTATUS Status = KeWaitForMultipleObjects(
+            NumWaitObjects,
+            WaitObjects,
+            WaitAny,
+            Executive,
+            KernelMode,
+            FALSE,
+            &Timeout,
+            NULL);
+        if (Status == STATUS_WAIT_0 || Status == STATUS_WAIT_1) {
+            break;
+        }
+        if (Status == STATUS_WAIT_2) {
+            NumPresents++;
+            Damage = GetQueuedDamage(NumPresents);
+        }
+    }
+
+    m_BudgetTokens = max(m_BudgetTokens - (LONGLONG)Damage, -m_BudgetBurst);
+
+    if (Throttled) {
+        m_Stats.ThrottledBytes += Damage;
+        m_Stats.ThrottleTicks += KeQueryPerformanceCounter(NULL).QuadPart - Start.QuadPart;
+    }
+    return NumPresents;
+}
+
+ULONGLONG BDD_HWBLT::GetQueuedDamage(UINT NumPresents)
+/*++
+
+  Routine Description:
+
+    The method returns the bytes of frame buffer covered by the moves and
+    dirty rects of the presents at the head of the queue, counting the
+    pixels they overlap on once unless they have more than
+    BDD_SCHEDULE_MAX_RECTS rects
+
+  Arguments:
+
+    NumPresents - number of queued presents starting at the head
+
+  Return Value:
+
+    Bytes of damage
+
+--*/
+{
+    PAGED_CODE();
+
+    CONST DO_PRESENT_MEMORY *pNewest =
+        &m_PresentQueue[(m_QueueHead + NumPresents - 1) % BDD_PRESENT_QUEUE_DEPTH].Present;
+    BOOLEAN Rotated = pNewest->Rotation == D3DKMDT_VPPR_ROTATE90 || pNewest->Rotation == D3DKMDT_VPPR_ROTATE270;
+    LONG Width = (LONG)(Rotated ? pNewest->SrcHeight : pNewest->SrcWidth);
+    LONG Height = (LONG)(Rotated ? pNewest->SrcWidth : pNewest->SrcHeight);
+
+    // Overlaps are counted twice if the region cannot be grown, or would take too long to build as for scheduling,
+    // which only makes the budget stricter
+    ULONG NumRects = 0;
+    for (UINT i = 0; i < NumPresents; i++) {
+        CONST DO_PRESENT_MEMORY *pPresent = &m_PresentQueue[(m_QueueHead + i) % BDD_PRESENT_QUEUE_DEPTH].Present;
+        NumRects += pPresent->NumMoves + pPresent->NumDirtyRects;
+    }
+    ULONGLONG Pixels = 0;
+    BOOLEAN Banded = NumRects <= BDD_SCHEDULE_MAX_RECTS;
+    m_QueuedDamage.SetEmpty();
+    for (UINT i = 0; i < NumPresents; i++) {
+        CONST DO_PRESENT_MEMORY *pPresent = &m_PresentQueue[(m_QueueHead + i) % BDD_PRESENT_QUEUE_DEPTH].Present;
+        for (ULONG j = 0; j < pPresent->NumMoves + pPresent->NumDirtyRects; j++) {
+            RECT Rect = (j < pPresent->NumMoves) ? pPresent->Moves[j].DestRect
+                                                  : pPresent->DirtyRect[j - pPresent->NumMoves];
+            Rect.left = max(Rect.left, 0);
+            Rect.top = max(Rect.top, 0);
+            Rect.right = min(Rect.right, Width);
+            Rect.bottom = min(Rect.bottom, Height);
+            if (Rect.left >= Rect.right || Rect.top >= Rect.bottom) {
+                continue;
+            }
+            if (Banded && !NT_SUCCESS(m_QueuedDamage.UnionRect(&Rect))) {
+                Banded = FALSE;
+            }
+            Pixels += (ULONGLONG)(Rect.right - Rect.left) * (Rect.bottom - Rect.top);
+        }
+    }
+
+    if (Banded) {
+        Pixels = 0;
+        for (UINT i = 0; i < m_QueuedDamage.GetNumRects(); i++) {
+            CONST RECT *pRect = &m_QueuedDamage.GetRects()[i];
+            Pixels += (ULONGLONG)(pRect->right - pRect->left) * (pRect->bottom - pRect->top);
+        }
+    }
+    return Pixels * (pNewest->DstBitPerPixel / 8);
+}
+
+BOOLEAN BDD_HWBLT::CoalescePresents(UINT NumPresents)
+/*++
+
+  Routine Description:
+
+    The method builds in m_CoalescedPresent a present of the source of the
+    newest queued present with the moves and dirty rects of all of them as
+    dirty rects. The source holds the whole desktop, so copying the damage
+    of the older presents from the newest source shows the same frame as
+    executing them in order, and the older sources are not read at all.
+
+  Arguments:
+
+    NumPresents - number of queued presents starting at the head
+
+  Return Value:
+
+    FALSE if the rects could not be allocated, the presents must then be
+    executed one by one
+
+--*/
+{
+    PAGED_CODE();
+
+    UINT NumRects = 0;
+    for (UINT i = 0; i < NumPresents; i++) {
+        CONST DO_PRESENT_MEMORY *pPresent = &m_PresentQueue[(m_QueueHead + i) % BDD_PRESENT_QUEUE_DEPTH].Present;
+        NumRects += pPresent->NumMoves + pPresent->NumDirtyRects;
+    }
+
+    if (NumRects > m_CoalescedCapacity) {
+        UINT Capacity = max(NumRects, BDD_PRESENT_MIN_RECTS * BDD_PRESENT_QUEUE_DEPTH);
+        RECT *pRects = new (PagedPool) RECT[Capacity];
+        if (!pRects) {
+            return FALSE;
+        }
+        delete[] m_pCoalescedRects;
+        m_pCoalescedRects = pRects;
+        m_CoalescedCapacity = Capacity;
+        m_Stats.Allocations++;
+    }
+
+    NumRects = 0;
+    for (UINT i = 0; i < NumPresents; i++) {
+        CONST DO_PRESENT_MEMORY *pPresent = &m_PresentQueue[(m_QueueHead + i) % BDD_PRESENT_QUEUE_DEPTH].Present;
+        for (ULONG j = 0; j < pPresent->NumMoves; j++) {
+            m_pCoalescedRects[NumRects++] = pPresent->Moves[j].DestRect;
+        }
+        if (pPresent->NumDirtyRects != 0) {
+            RtlCopyMemory(m_pCoalescedRects + NumRects, pPresent->DirtyRect, pPresent->NumDirtyRects * sizeof(RECT));
+            NumRects += pPresent->NumDirtyRects;
+        }
+    }
+
+    m_CoalescedPresent = m_PresentQueue[(m_QueueHead + NumPresents - 1) % BDD_PRESENT_QUEUE_DEPTH].Present;
+    m_CoalescedPresent.NumMoves = 0;
+    m_CoalescedPresent.Moves = NULL;
+    m_CoalescedPresent.NumDirtyRects = NumRects;
+    m_CoalescedPresent.DirtyRect = m_pCoalescedRects;
+    return TRUE;
+}
+
+VOID BDD_HWBLT::AllocateBackBuffer(_In_ CONST CURRENT_BDD_MODE *pMode) {
+    PAGED_CODE();
+
+    if (m_FlushInterval == 0) {
+        return;
+    }
+
+    KeAcquireGuardedMutex(&m_FlushLock);
+
+    // The back buffer only grows, and starts black like the frame buffer after the mode set
+    SIZE_T Size = (SIZE_T)pMode->SrcModeWidth * pMode->SrcModeHeight * sizeof(ULONG);
+    if (Size > m_BackBufferSize) {
+        delete[] m_pBackBuffer;
+        m_pBackBuffer = new (PagedPool) BYTE[Size];
+        m_BackBufferSize = (m_pBackBuffer != NULL) ? Size : 0;
+        if (m_pBackBuffer == NULL) {
+            BDD_LOG_WARNING("Allocating a 0x%zx bytes back buffer failed, presents are not deferred", Size);
+        }
+    }
+    if (m_pBackBuffer != NULL) {
+        RtlZeroMemory(m_pBackBuffer, Size);
+    }
+
+    KeAcquireGuardedMutex(&m_DeferredLock);
+    m_DeferredDamage.SetEmpty();
+    m_DeferredOverflow = FALSE;
+    m_DeferredDstAddr = NULL; // The frame buffer was remapped, the next present sets it
+    KeReleaseGuardedMutex(&m_DeferredLock);
+
+    KeReleaseGuardedMutex(&m_FlushLock);
+}
+
+NTSTATUS BDD_HWBLT::DeferPresent(
+    _In_ BYTE *DstAddr,
+    _In_ UINT DstBitPerPixel,
+    _In_ BYTE *SrcAddr,
+    _In_ LONG SrcPitch,
+    _In_ ULONG NumMoves,
+    _In_reads_opt_(NumMoves) CONST D3DKMT_MOVE_RECT *pMoves,
+    _In_ ULONG NumDirtyRects,
+    _In_reads_opt_(NumDirtyRects) CONST RECT *pDirtyRect,
+    _In_ D3DKMDT_VIDPN_PRESENT_PATH_ROTATION Rotation)
+/*++
+
+  Routine Description:
+
+    The method copies the moves and dirty rects of a present from the
+    source to the back buffer and adds them to the damage, which the flush
+    thread writes to the frame buffer at its next interval. Only system
+    memory is written, so the present completes without waiting for video
+    memory. The copy holds m_DeferredLock, so the damage taken by a flush
+    is always in the back buffer.
+
+  Arguments:
+
+    DstAddr - address of the frame buffer the damage is flushed to
+    DstBitPerPixel - color depth of the frame buffer
+    SrcAddr - address of source surface
+    SrcPitch - source surface pitch (bytes in a row)
+    NumMoves - number of moves to be copied
+    pMoves - moves' data
+    NumDirtyRects - number of rectangles to be copied
+    pDirtyRect - rectangles' data
+    Rotation - rotation to be performed when flushing
+
+  Return Value:
+
+    STATUS_SUCCESS, the present is complete
+
+--*/
+{
+    PAGED_CODE();
+
+    const CURRENT_BDD_MODE *pModeCur = m_DevExt->GetCurrentMode(m_SourceId);
+    BOOLEAN Rotated = Rotation == D3DKMDT_VPPR_ROTATE90 || Rotation == D3DKMDT_VPPR_ROTATE270;
+
+    // Read from the caller's address space, BltBits stops at an invalid source
     BLT_INFO SrcBltInfo;
-    SrcBltInfo.pBits = Context->SrcAddr;
-    SrcBltInfo.Pitch = Context->SrcPitch;
+    SrcBltInfo.pBits = SrcAddr;
+    SrcBltInfo.Pitch = SrcPitch;
     SrcBltInfo.BitsPerPel = 32;
     SrcBltInfo.Offset.x = 0;
     SrcBltInfo.Offset.y = 0;
     SrcBltInfo.Rotation = D3DKMDT_VPPR_IDENTITY;
-    if (Context->Rotation == D3DKMDT_VPPR_ROTATE90 || Context->Rotation == D3DKMDT_VPPR_ROTATE270) {
-        SrcBltInfo.Width = DstBltInfo.Height;
-        SrcBltInfo.Height = DstBltInfo.Width;
-    } else {
-        SrcBltInfo.Width = DstBltInfo.Width;
-        SrcBltInfo.Height = DstBltInfo.Height;
+    SrcBltInfo.Width = Rotated ? pModeCur->SrcModeHeight : pModeCur->SrcModeWidth;
+    SrcBltInfo.Height = Rotated ? pModeCur->SrcModeWidth : pModeCur->SrcModeHeight;
+
+    BLT_INFO BackBltInfo = SrcBltInfo;
+    BackBltInfo.pBits = m_pBackBuffer;
+    BackBltInfo.Pitch = SrcBltInfo.Width * sizeof(ULONG);
+
+    KeAcquireGuardedMutex(&m_DeferredLock);
+
+    for (ULONG i = 0; i < NumMoves + NumDirtyRects; i++) {
+        RECT Rect = (i < NumMoves) ? pMoves[i].DestRect : pDirtyRect[i - NumMoves];
+        if (!ClipToSource(&Rect, &SrcBltInfo)) {
+            continue;
+        }
+        BltBits(&BackBltInfo, &SrcBltInfo, 1, &Rect);
+        if (!m_DeferredOverflow && !NT_SUCCESS(m_DeferredDamage.UnionRect(&Rect))) {
+            m_DeferredOverflow = TRUE;
+        }
     }
+    BltFlush();
 
-    // Copy all the scroll rects from source image to video frame buffer.
-    for (UINT i = 0; i < Context->NumMoves; i++) {
-        BltBits(
-            &DstBltInfo,
-            &SrcBltInfo,
-            1, // NumRects
-            &Context->Moves[i].DestRect);
+    m_DeferredDstAddr = DstAddr;
+    m_DeferredDstBitPerPixel = DstBitPerPixel;
+    m_DeferredRotation = Rotation;
+
+    KeReleaseGuardedMutex(&m_DeferredLock);
+
+    m_Stats.Presents++;
+    return STATUS_SUCCESS;
+}
+
+VOID BDD_HWBLT::FlushWorker() {
+    PAGED_CODE();
+
+    LARGE_INTEGER Interval;
+    Interval.QuadPart = -10000LL * m_FlushInterval;
+    while (KeWaitForSingleObject(&m_StopWorkerEvent, Executive, KernelMode, FALSE, &Interval) == STATUS_TIMEOUT) {
+        FlushBackBuffer(TRUE);
     }
+}
 
-    // Copy all the dirty rects from source image to video frame buffer.
-    for (UINT i = 0; i < Context->NumDirtyRects; i++) {
-        BltBits(
-            &DstBltInfo,
-            &SrcBltInfo,
-            1, // NumRects
-            &Context->DirtyRect[i]);
+VOID BDD_HWBLT::FlushBackBuffer(BOOLEAN MayDefer)
+/*++
+
+  Routine Description:
+
+    The method takes the damage accumulated since the last flush and
+    writes it from the back buffer to the frame buffer, as a present of the
+    back buffer. Presents deferred while it runs only add damage for the
+    next flush.
+
+  Arguments:
+
+    MayDefer - TRUE if the adaptive policy may leave tiles to the next
+               flush, FALSE if all the damage must be written
+
+  Return Value:
+
+    None
+
+--*/
+{
+    PAGED_CODE();
+
+    KeAcquireGuardedMutex(&m_FlushLock);
+    KeAcquireGuardedMutex(&m_DeferredLock);
+
+    UINT NumRects = m_DeferredOverflow ? 1 : m_DeferredDamage.GetNumRects();
+    if (NumRects > m_FlushCapacity) {
+        UINT Capacity = max(NumRects, BDD_MIN_DAMAGE_RECTS);
+        RECT *pRects = new (PagedPool) RECT[Capacity];
+        if (pRects != NULL) {
+            delete[] m_pFlushRects;
+            m_pFlushRects = pRects;
+            m_FlushCapacity = Capacity;
+            m_Stats.Allocations++;
+        } else {
+            // The damage is kept for the next flush
+            NumRects = 0;
+        }
+    }
+
+    const CURRENT_BDD_MODE *pModeCur = m_DevExt->GetCurrentMode(m_SourceId);
+    BOOLEAN Rotated = m_DeferredRotation == D3DKMDT_VPPR_ROTATE90 || m_DeferredRotation == D3DKMDT_VPPR_ROTATE270;
+    UINT SrcWidth = Rotated ? pModeCur->SrcModeHeight : pModeCur->SrcModeWidth;
+    UINT SrcHeight = Rotated ? pModeCur->SrcModeWidth : pModeCur->SrcModeHeight;
+
+    if (NumRects != 0) {
+        if (m_DeferredOverflow) {
+            m_pFlushRects[0].left = 0;
+            m_pFlushRects[0].top = 0;
+            m_pFlushRects[0].right = (LONG)SrcWidth;
+            m_pFlushRects[0].bottom = (LONG)SrcHeight;
+        } else {
+            RtlCopyMemory(m_pFlushRects, m_DeferredDamage.GetRects(), NumRects * sizeof(RECT));
+        }
+        m_DeferredDamage.SetEmpty();
+        m_DeferredOverflow = FALSE;
+    }
+
+    PDO_PRESENT_MEMORY Context = &m_FlushPresent;
+    Context->DstAddr = m_DeferredDstAddr;
+    Context->DstBitPerPixel = m_DeferredDstBitPerPixel;
+    Context->Rotation = m_DeferredRotation;
+
+    KeReleaseGuardedMutex(&m_DeferredLock);
+
+    if (NumRects != 0 && m_pBackBuffer != NULL && Context->DstAddr != NULL && pModeCur->Flags.FrameBufferIsActive) {
+        Context->DstStride = pModeCur->DispInfo.Pitch;
+        Context->DstFrameSize =
+            pModeCur->Flags.DoubleBuffered ? pModeCur->DispInfo.Pitch * pModeCur->DispInfo.Height : 0;
+        Context->DstPanRows = pModeCur->Flags.ScrollPanned ? pModeCur->VirtualHeight : 0;
+        Context->SrcWidth = pModeCur->SrcModeWidth;
+        Context->SrcHeight = pModeCur->SrcModeHeight;
+        Context->SrcAddr = m_pBackBuffer;
+        Context->SrcPitch = (LONG)(SrcWidth * sizeof(ULONG));
+        Context->pMapping = NULL;
+        Context->Mdl = NULL;
+        Context->NumMoves = 0;
+        Context->Moves = NULL;
+        Context->NumDirtyRects = NumRects;
+        Context->DirtyRect = m_pFlushRects;
+        Context->SourceID = m_SourceId;
+        Context->hAdapter = m_DevExt;
+        Context->DisplaySource = this;
+
+        LARGE_INTEGER Frequency;
+        LARGE_INTEGER Start = KeQueryPerformanceCounter(&Frequency);
+        m_FlushSequence++;
+        m_FlushMayDefer = MayDefer && m_FlushWriteBound;
+        HwExecutePresentDisplayOnly(Context);
+        m_Stats.DeferredFlushes++;
+
+        // Over half the interval spent writing, the adaptive policy spreads the tiles written every time over two
+        LONGLONG Ticks = KeQueryPerformanceCounter(NULL).QuadPart - Start.QuadPart;
+        m_FlushWriteBound = Ticks * 2000 > (LONGLONG)m_FlushInterval * Frequency.QuadPart;
     }
 
-    delete[] reinterpret_cast<BYTE *>(Context);
+    KeReleaseGuardedMutex(&m_FlushLock);
 }
 
-BDD_HWBLT::BDD_HWBLT() : m_SourceId(D3DDDI_ID_UNINITIALIZED), m_DevExt(NULL) {
+NTSTATUS BDD_HWBLT::AccumulateDarkPresent(
+    _In_ BYTE *SrcAddr,
+    _In_ LONG SrcPitch,
+    _In_ ULONG NumMoves,
+    _In_ D3DKMT_MOVE_RECT *Moves,
+    _In_ ULONG NumDirtyRects,
+    _In_ RECT *DirtyRect,
+    _In_ D3DKMDT_VIDPN_PRESENT_PATH_ROTATION Rotation)
+/*++
+
+  Routine Description:
+
+    The method adds the rects of a present made while the source is dark
+    to the dark damage, and keeps its source surface locked in place of the
+    one of the previous dark present. Only the destination of the moves is
+    needed, as the latest source holds the result of all of them.
+
+  Arguments:
+
+    SrcAddr - address of source surface
+    SrcPitch - source surface pitch (bytes in a row)
+    NumMoves - number of moves
+    Moves - moves' data
+    NumDirtyRects - number of dirty rectangles
+    DirtyRect - rectangles' data
+    Rotation - rotation the source is presented with
+
+  Return Value:
+
+    STATUS_SUCCESS, if the source cannot be locked the next dark present
+    catches up with the whole source
+
+--*/
+{
     PAGED_CODE();
+
+    const CURRENT_BDD_MODE *pModeCur = m_DevExt->GetCurrentMode(m_SourceId);
+    BOOLEAN Rotated = Rotation == D3DKMDT_VPPR_ROTATE90 || Rotation == D3DKMDT_VPPR_ROTATE270;
+    UINT SrcWidth = Rotated ? pModeCur->SrcModeHeight : pModeCur->SrcModeWidth;
+    UINT SrcHeight = Rotated ? pModeCur->SrcModeWidth : pModeCur->SrcModeHeight;
+
+    KeAcquireGuardedMutex(&m_DarkLock);
+
+    // The new source is locked before the previous one is released, so a cached mapping of the same surface stays
+    DO_PRESENT_MEMORY Source;
+    RtlZeroMemory(&Source, sizeof(Source));
+    Source.SrcPitch = SrcPitch;
+    NTSTATUS Status = AcquirePresentSource(&Source, SrcAddr, (SIZE_T)SrcPitch * SrcHeight);
+    if (!NT_SUCCESS(Status)) {
+        BDD_LOG_WARNING("Locking dark source 0x%p failed with status 0x%x", SrcAddr, Status);
+
+        // The rects of this present are lost, only a later source can catch up, with all of it
+        ReleaseDarkPresent();
+        m_DarkDamage.SetEmpty();
+        m_DarkOverflow = TRUE;
+        KeReleaseGuardedMutex(&m_DarkLock);
+        return STATUS_SUCCESS;
+    }
+
+    ReleaseDarkPresent();
+    m_DarkPresent.SrcAddr = Source.SrcAddr;
+    m_DarkPresent.SrcPitch = SrcPitch;
+    m_DarkPresent.pMapping = Source.pMapping;
+    m_DarkPresent.Mdl = Source.Mdl;
+    m_DarkPresent.Rotation = Rotation;
+    m_DarkProcess = PsGetCurrentProcess();
+    m_DarkPending = TRUE;
+
+    RECT Bounds = {0, 0, (LONG)SrcWidth, (LONG)SrcHeight};
+    for (ULONG i = 0; i < NumMoves + NumDirtyRects && !m_DarkOverflow; i++) {
+        RECT Rect = (i < NumMoves) ? Moves[i].DestRect : DirtyRect[i - NumMoves];
+        Rect.left = max(Rect.left, Bounds.left);
+        Rect.top = max(Rect.top, Bounds.top);
+        Rect.right = min(Rect.right, Bounds.right);
+        Rect.bottom = min(Rect.bottom, Bounds.bottom);
+        if (Rect.left < Rect.right && Rect.top < Rect.bottom && !NT_SUCCESS(m_DarkDamage.UnionRect(&Rect))) {
+            m_DarkOverflow = TRUE;
+        }
+    }
+
+    m_Stats.DarkPresents++;
+    KeReleaseGuardedMutex(&m_DarkLock);
+    return STATUS_SUCCESS;
 }
 
-BDD_HWBLT::~BDD_HWBLT()
+VOID BDD_HWBLT::CatchUpDarkPresents(_In_ BYTE *DstAddr, _In_ UINT DstBitPerPixel)
 /*++
 
   Routine Description:
 
-    This routine waits on present worker thread to exit before
-    destroying the object
+    The method copies the dark damage from the latest dark source with a
+    single present, executed right away or through the deferred I/O back
+    buffer, and forgets the dark presents. The worker must be idle.
 
   Arguments:
 
-    None
+    DstAddr - address of the frame buffer the damage is copied to
+    DstBitPerPixel - color depth of the frame buffer
 
   Return Value:
 
@@ -115,6 +2545,120 @@ BDD_HWBLT::~BDD_HWBLT()
 --*/
 {
     PAGED_CODE();
+
+    KeAcquireGuardedMutex(&m_DarkLock);
+    if (!m_DarkPending) {
+        KeReleaseGuardedMutex(&m_DarkLock);
+        return;
+    }
+
+    const CURRENT_BDD_MODE *pModeCur = m_DevExt->GetCurrentMode(m_SourceId);
+    PDO_PRESENT_MEMORY Context = &m_DarkPresent;
+    BOOLEAN Rotated = Context->Rotation == D3DKMDT_VPPR_ROTATE90 || Context->Rotation == D3DKMDT_VPPR_ROTATE270;
+    RECT Full = {
+        0,
+        0,
+        (LONG)(Rotated ? pModeCur->SrcModeHeight : pModeCur->SrcModeWidth),
+        (LONG)(Rotated ? pModeCur->SrcModeWidth : pModeCur->SrcModeHeight)};
+
+    UINT NumRects = m_DarkOverflow ? 1 : m_DarkDamage.GetNumRects();
+    CONST RECT *pRects = m_DarkOverflow ? &Full : m_DarkDamage.GetRects();
+
+    if (NumRects != 0 && pModeCur->Flags.FrameBufferIsActive) {
+        if (m_FlushInterval != 0 && m_pBackBuffer != NULL) {
+            DeferPresent(
+                DstAddr,
+                DstBitPerPixel,
+                Context->SrcAddr,
+                Context->SrcPitch,
+                0,
+                NULL,
+                NumRects,
+                pRects,
+                Context->Rotation);
+            FlushBackBuffer(FALSE);
+        } else {
+            Context->DstAddr = DstAddr;
+            Context->DstBitPerPixel = DstBitPerPixel;
+            Context->DstStride = pModeCur->DispInfo.Pitch;
+            Context->DstFrameSize =
+                pModeCur->Flags.DoubleBuffered ? pModeCur->DispInfo.Pitch * pModeCur->DispInfo.Height : 0;
+            Context->DstPanRows = pModeCur->Flags.ScrollPanned ? pModeCur->VirtualHeight : 0;
+            Context->SrcWidth = pModeCur->SrcModeWidth;
+            Context->SrcHeight = pModeCur->SrcModeHeight;
+            Context->NumMoves = 0;
+            Context->Moves = NULL;
+            Context->NumDirtyRects = NumRects;
+            Context->DirtyRect = pRects;
+            Context->SourceID = m_SourceId;
+            Context->hAdapter = m_DevExt;
+            Context->DisplaySource = this;
+            HwExecutePresentDisplayOnly(Context);
+        }
+        m_Stats.DarkCatchUps++;
+    }
+
+    ReleaseDarkPresent();
+    m_DarkDamage.SetEmpty();
+    m_DarkOverflow = FALSE;
+    KeReleaseGuardedMutex(&m_DarkLock);
+}
+
+VOID BDD_HWBLT::DiscardDarkPresents(_In_opt_ PEPROCESS Process) {
+    PAGED_CODE();
+
+    KeAcquireGuardedMutex(&m_DarkLock);
+    if (Process == NULL) {
+        ReleaseDarkPresent();
+        m_DarkDamage.SetEmpty();
+        m_DarkOverflow = FALSE;
+    } else if (m_DarkPending && m_DarkProcess == Process) {
+        // The surface goes away with the process, a later dark source catches up with all of it
+        ReleaseDarkPresent();
+        m_DarkDamage.SetEmpty();
+        m_DarkOverflow = TRUE;
+    }
+    KeReleaseGuardedMutex(&m_DarkLock);
+}
+
+VOID BDD_HWBLT::ReleaseDarkPresent() {
+    PAGED_CODE();
+
+    if (m_DarkPending) {
+        ReleasePresentSource(&m_DarkPresent);
+        m_DarkProcess = NULL;
+        m_DarkPending = FALSE;
+    }
+}
+
+NTSTATUS BDD_HWBLT::ReserveRects(_Inout_ BDD_PRESENT_ENTRY *pEntry, ULONG NumMoves, ULONG NumDirtyRects) {
+    PAGED_CODE();
+
+    if (NumMoves > pEntry->MoveCapacity) {
+        ULONG Capacity = max(NumMoves, BDD_PRESENT_MIN_RECTS);
+        D3DKMT_MOVE_RECT *pStore = new (PagedPool) D3DKMT_MOVE_RECT[Capacity];
+        if (!pStore) {
+            return STATUS_NO_MEMORY;
+        }
+        delete[] pEntry->pMoveStore;
+        pEntry->pMoveStore = pStore;
+        pEntry->MoveCapacity = Capacity;
+        m_Stats.Allocations++;
+    }
+
+    if (NumDirtyRects > pEntry->DirtyRectCapacity) {
+        ULONG Capacity = max(NumDirtyRects, BDD_PRESENT_MIN_RECTS);
+        RECT *pStore = new (PagedPool) RECT[Capacity];
+        if (!pStore) {
+            return STATUS_NO_MEMORY;
+        }
+        delete[] pEntry->pDirtyRectStore;
+        pEntry->pDirtyRectStore = pStore;
+        pEntry->DirtyRectCapacity = Capacity;
+        m_Stats.Allocations++;
+    }
+
+    return STATUS_SUCCESS;
 }
 
 NTSTATUS
@@ -133,8 +2677,8 @@ BDD_HWBLT::ExecutePresentDisplayOnly(
 
   Routine Description:
 
-    The method creates present worker thread and provides context
-    for it filled with present commands
+    The method queues the present commands to the present worker thread,
+    or executes them right away when there is no worker to execute them
 
   Arguments:
 
@@ -148,11 +2692,11 @@ BDD_HWBLT::ExecutePresentDisplayOnly(
     NumDirtyRects - number of rectangles to be copied
     DirtyRect - rectangles' data
     Rotation - roatation to be performed when executing copy
-    CallBack - callback for present worker thread to report execution status
 
   Return Value:
 
-    Status
+    STATUS_PENDING if the present was queued, completion is then reported
+    with DxgkCbPresentDisplayOnlyProgress
 
 --*/
 {
@@ -160,25 +2704,88 @@ BDD_HWBLT::ExecutePresentDisplayOnly(
 
     UNREFERENCED_PARAMETER(SrcBytesPerPixel);
 
-    SIZE_T sizeMoves = NumMoves * sizeof(D3DKMT_MOVE_RECT);
-    SIZE_T sizeRects = NumDirtyRects * sizeof(RECT);
-    SIZE_T size = sizeof(DO_PRESENT_MEMORY) + sizeMoves + sizeRects;
+    // The screen follows presents again, a later dark period only needs to catch up with its own damage
+    m_DarkOverflow = FALSE;
 
-    PDO_PRESENT_MEMORY Context = reinterpret_cast<PDO_PRESENT_MEMORY>(new (PagedPool) BYTE[size]);
-
-    if (!Context) {
-        return STATUS_NO_MEMORY;
+    if (m_FlushInterval != 0 && m_pBackBuffer != NULL) {
+        return DeferPresent(
+            DstAddr,
+            DstBitPerPixel,
+            SrcAddr,
+            SrcPitch,
+            NumMoves,
+            Moves,
+            NumDirtyRects,
+            DirtyRect,
+            Rotation);
     }
 
     const CURRENT_BDD_MODE *pModeCur = m_DevExt->GetCurrentMode(m_SourceId);
 
+    // Blocks while the worker is BDD_PRESENT_QUEUE_DEPTH presents behind. A deferred I/O worker only flushes the back
+    // buffer and never drains the queue, so without a back buffer the present is executed synchronously.
+    BDD_PRESENT_ENTRY *pEntry = NULL;
+    PDO_PRESENT_MEMORY Context = &m_PresentContext;
+    if (m_pPresentWorkerThread != NULL && m_FlushInterval == 0) {
+        KeWaitForSingleObject(&m_FreePresentEntries, Executive, KernelMode, FALSE, NULL);
+        pEntry = &m_PresentQueue[m_QueueTail];
+        Context = &pEntry->Present;
+    }
+
+    // Map the source surface into system space, so the worker and band threads can read it. If this fails the present
+    // is executed synchronously from the user-mode address.
+    UINT SrcRows = (Rotation == D3DKMDT_VPPR_ROTATE90 || Rotation == D3DKMDT_VPPR_ROTATE270) ? pModeCur->SrcModeWidth
+                                                                                            : pModeCur->SrcModeHeight;
+    Context->SrcAddr = SrcAddr;
+    Context->SrcPitch = SrcPitch;
+    NTSTATUS Status = AcquirePresentSource(Context, SrcAddr, (SIZE_T)SrcPitch * SrcRows);
+    if (NT_SUCCESS(Status)) {
+        m_LockFailedSource = NULL;
+    } else {
+        if (SrcAddr != m_LockFailedSource) {
+            BDD_LOG_WARNING("Locking source 0x%p failed with status 0x%x", SrcAddr, Status);
+            m_LockFailedSource = SrcAddr;
+        }
+        m_Stats.SourceLockFailures++;
+        if (pEntry != NULL) {
+            // Executed after the queued presents, which also own the change detection state
+            KeReleaseSemaphore(&m_FreePresentEntries, IO_NO_INCREMENT, 1, FALSE);
+            WaitForPresents();
+            pEntry = NULL;
+            Context = &m_PresentContext;
+            Context->SrcAddr = SrcAddr;
+            Context->SrcPitch = SrcPitch;
+            Context->pMapping = NULL;
+            Context->Mdl = NULL;
+        }
+    }
+
+    if (pEntry != NULL) {
+        Status = ReserveRects(pEntry, NumMoves, NumDirtyRects);
+        if (!NT_SUCCESS(Status)) {
+            ReleasePresentSource(Context);
+            KeReleaseSemaphore(&m_FreePresentEntries, IO_NO_INCREMENT, 1, FALSE);
+            return Status;
+        }
+
+        // The rect arrays of the DDI arguments are only valid until it returns
+        if (NumMoves) {
+            RtlCopyMemory(pEntry->pMoveStore, Moves, NumMoves * sizeof(D3DKMT_MOVE_RECT));
+        }
+        if (NumDirtyRects) {
+            RtlCopyMemory(pEntry->pDirtyRectStore, DirtyRect, NumDirtyRects * sizeof(RECT));
+        }
+        Moves = pEntry->pMoveStore;
+        DirtyRect = pEntry->pDirtyRectStore;
+    }
+
     Context->DstAddr = DstAddr;
     Context->DstBitPerPixel = DstBitPerPixel;
     Context->DstStride = pModeCur->DispInfo.Pitch;
+    Context->DstFrameSize = pModeCur->Flags.DoubleBuffered ? pModeCur->DispInfo.Pitch * pModeCur->DispInfo.Height : 0;
+    Context->DstPanRows = pModeCur->Flags.ScrollPanned ? pModeCur->VirtualHeight : 0;
     Context->SrcWidth = pModeCur->SrcModeWidth;
     Context->SrcHeight = pModeCur->SrcModeHeight;
-    Context->SrcAddr = SrcAddr;
-    Context->SrcPitch = SrcPitch;
     Context->Rotation = Rotation;
     Context->NumMoves = NumMoves;
     Context->Moves = Moves;
@@ -188,21 +2795,46 @@ BDD_HWBLT::ExecutePresentDisplayOnly(
     Context->hAdapter = m_DevExt;
     Context->DisplaySource = this;
 
-    BYTE *rects = reinterpret_cast<BYTE *>(Context + 1);
-
-    // copy moves and update pointer
-    if (Moves) {
-        memcpy(rects, Moves, sizeMoves);
-        Context->Moves = reinterpret_cast<D3DKMT_MOVE_RECT *>(rects);
-        rects += sizeMoves;
+    if (pEntry != NULL) {
+        m_QueueTail = (m_QueueTail + 1) % BDD_PRESENT_QUEUE_DEPTH;
+        KeReleaseSemaphore(&m_QueuedPresents, IO_NO_INCREMENT, 1, FALSE);
+        Status = STATUS_PENDING;
+    } else {
+        // The present is executed before returning, so the rects are used in place from the caller's arrays
+        HwExecutePresentDisplayOnly(Context);
+        ReleasePresentSource(Context);
+        Status = STATUS_SUCCESS;
     }
 
-    // copy dirty rects and update pointer
-    if (DirtyRect) {
-        memcpy(rects, DirtyRect, sizeRects);
-        Context->DirtyRect = reinterpret_cast<RECT *>(rects);
+    if ((++m_Stats.Presents % BDD_PRESENT_STATS_INTERVAL) == 0) {
+        BDD_LOG_TRACE(
+            "Source %u: %I64u presents, %I64u present allocations, %I64u source cache hits, %I64u misses, "
+            "%I64u lock failures, %I64u pages written by %I64u scheduled presents, %I64u rects merged, "
+            "%I64u copy ticks, %I64u scrolls panned with %I64u rebases, %I64u presents coalesced, "
+            "%I64u bytes throttled for %I64u ticks, %I64u deferred flushes, %I64u tiles compared, %I64u copied, "
+            "%I64u deferred, %I64u dark presents caught up by %I64u presents",
+            m_SourceId,
+            m_Stats.Presents,
+            m_Stats.Allocations,
+            m_Stats.SourceCacheHits,
+            m_Stats.SourceCacheMisses,
+            m_Stats.SourceLockFailures,
+            m_Stats.PagesWritten,
+            m_Stats.ScheduledPresents,
+            m_Stats.RectsMerged,
+            m_Stats.CopyTicks,
+            m_Stats.ScrollsPanned,
+            m_Stats.PanRebases,
+            m_Stats.PresentsCoalesced,
+            m_Stats.ThrottledBytes,
+            m_Stats.ThrottleTicks,
+            m_Stats.DeferredFlushes,
+            m_Stats.TilesCompared,
+            m_Stats.TilesCopied,
+            m_Stats.TilesDeferred,
+            m_Stats.DarkPresents,
+            m_Stats.DarkCatchUps);
     }
 
-    HwExecutePresentDisplayOnly(Context);
-    return STATUS_SUCCESS;
+    return Status;
 }